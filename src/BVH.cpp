@@ -0,0 +1,317 @@
+#include "BVH.h"
+
+static float surfaceArea(const glm::vec3 & lo, const glm::vec3 & hi) {
+	glm::vec3 d = hi - lo;
+	return 2 * (d.x * d.y + d.y * d.z + d.z * d.x);
+}
+
+static void grow(glm::vec3 & lo, glm::vec3 & hi, const glm::vec3 & pmin, const glm::vec3 & pmax) {
+	lo = glm::min(lo, pmin);
+	hi = glm::max(hi, pmax);
+}
+
+// create:  bound every triangle once, then split the root recursively.  The
+//          triangle ids are partitioned in place, so every leaf owns a run
+//          of "indices".
+//
+void BVH::create(const ofMesh & geo) {
+	mesh = geo;
+	nodes.clear();
+	indices.clear();
+	revision++;
+
+	const vector<glm::vec3> & verts = mesh.getVertices();
+	int numTriangles = mesh.getNumIndices() / 3;
+	vector<glm::vec3> triMin(numTriangles);
+	vector<glm::vec3> triMax(numTriangles);
+	vector<glm::vec3> centroids(numTriangles);
+	indices.resize(numTriangles);
+	for (int t = 0; t < numTriangles; t++) {
+		const glm::vec3 & v0 = verts[mesh.getIndex(t * 3)];
+		const glm::vec3 & v1 = verts[mesh.getIndex(t * 3 + 1)];
+		const glm::vec3 & v2 = verts[mesh.getIndex(t * 3 + 2)];
+		triMin[t] = glm::min(v0, glm::min(v1, v2));
+		triMax[t] = glm::max(v0, glm::max(v1, v2));
+		centroids[t] = (triMin[t] + triMax[t]) * 0.5f;
+		indices[t] = t;
+	}
+	if (numTriangles == 0) return;
+
+	// a binary tree has at most 2n - 1 nodes; reserving keeps the build from
+	// reallocating
+	//
+	nodes.reserve(2 * numTriangles);
+	BVHNode root;
+	root.first = 0;
+	root.numTriangles = numTriangles;
+	nodes.push_back(root);
+	split(0, 0, triMin, triMax, centroids);
+	nodes.shrink_to_fit();
+}
+
+// split:  bound "node", then bin its centroids along each axis and take the
+//         cheapest plane by the surface area heuristic.  The node stays a
+//         leaf if no plane beats testing its triangles directly.
+//
+void BVH::split(int node, int depth, const vector<glm::vec3> & triMin, const vector<glm::vec3> & triMax, const vector<glm::vec3> & centroids) {
+	int first = nodes[node].first;
+	int count = nodes[node].numTriangles;
+
+	glm::vec3 lo(FLT_MAX), hi(-FLT_MAX);
+	glm::vec3 cmin(FLT_MAX), cmax(-FLT_MAX);
+	for (int i = first; i < first + count; i++) {
+		int t = indices[i];
+		grow(lo, hi, triMin[t], triMax[t]);
+		grow(cmin, cmax, centroids[t], centroids[t]);
+	}
+	nodes[node].box = Box(Vector3(lo.x, lo.y, lo.z), Vector3(hi.x, hi.y, hi.z));
+	if (count <= minLeafSize || depth >= maxDepth) return;
+
+	// evaluate numBins - 1 planes per axis.  Cost of a split relative to one
+	// triangle test: traversalCost + (A(left) N(left) + A(right) N(right)) / A(node)
+	//
+	vector<int> binCount(numBins);
+	vector<glm::vec3> binMin(numBins), binMax(numBins);
+	vector<float> rightArea(numBins);
+	vector<int> rightCount(numBins);
+	float nodeArea = surfaceArea(lo, hi);
+	float bestCost = FLT_MAX;
+	int bestAxis = -1;
+	int bestBin = 0;
+	for (int axis = 0; axis < 3; axis++) {
+		float extent = cmax[axis] - cmin[axis];
+		if (extent <= 0) continue;
+		float scale = numBins / extent;
+		for (int b = 0; b < numBins; b++) {
+			binCount[b] = 0;
+			binMin[b] = glm::vec3(FLT_MAX);
+			binMax[b] = glm::vec3(-FLT_MAX);
+		}
+		for (int i = first; i < first + count; i++) {
+			int t = indices[i];
+			int b = std::min(numBins - 1, (int)((centroids[t][axis] - cmin[axis]) * scale));
+			binCount[b]++;
+			grow(binMin[b], binMax[b], triMin[t], triMax[t]);
+		}
+
+		// sweep from the right to get the area and count right of each plane,
+		// then from the left to price every plane
+		//
+		glm::vec3 rlo(FLT_MAX), rhi(-FLT_MAX);
+		int rcount = 0;
+		for (int b = numBins - 1; b > 0; b--) {
+			rcount += binCount[b];
+			if (binCount[b]) grow(rlo, rhi, binMin[b], binMax[b]);
+			rightCount[b] = rcount;
+			rightArea[b] = rcount ? surfaceArea(rlo, rhi) : 0;
+		}
+		glm::vec3 llo(FLT_MAX), lhi(-FLT_MAX);
+		int lcount = 0;
+		for (int b = 0; b < numBins - 1; b++) {
+			lcount += binCount[b];
+			if (binCount[b]) grow(llo, lhi, binMin[b], binMax[b]);
+			if (lcount == 0 || rightCount[b + 1] == 0) continue;
+			float cost = traversalCost + (surfaceArea(llo, lhi) * lcount + rightArea[b + 1] * rightCount[b + 1]) / nodeArea;
+			if (cost < bestCost) {
+				bestCost = cost;
+				bestAxis = axis;
+				bestBin = b;
+			}
+		}
+	}
+
+	int mid;
+	if (bestAxis >= 0 && (bestCost < count || count > maxLeafSize)) {
+		float scale = numBins / (cmax[bestAxis] - cmin[bestAxis]);
+		int * split = std::partition(&indices[first], &indices[first] + count, [&](int t) {
+			return std::min(numBins - 1, (int)((centroids[t][bestAxis] - cmin[bestAxis]) * scale)) <= bestBin;
+		});
+		mid = split - &indices[0];
+	}
+	else if (count > maxLeafSize) {
+		// every centroid in one spot: no plane separates them, so halve the run
+		//
+		mid = first + count / 2;
+	}
+	else return;
+
+	int child = nodes.size();
+	BVHNode left, right;
+	left.first = first;
+	left.numTriangles = mid - first;
+	right.first = mid;
+	right.numTriangles = first + count - mid;
+	nodes.push_back(left);
+	nodes.push_back(right);
+	nodes[node].first = child;
+	nodes[node].numTriangles = 0;
+	split(child, depth + 1, triMin, triMax, centroids);
+	split(child + 1, depth + 1, triMin, triMax, centroids);
+}
+
+NodeRef BVH::ref(int node) const {
+	NodeRef r;
+	r.node = node;
+	r.points = indices.data() + nodes[node].first;
+	r.numPoints = nodes[node].numTriangles;
+	return r;
+}
+
+// first leaf whose box holds the point
+//
+bool BVH::intersect(const ofVec3f & vec, NodeRef & nodeRtn) {
+	if (nodes.size() == 0) return false;
+	Vector3 p(vec.x, vec.y, vec.z);
+	int stack[maxStack];
+	int top = 0;
+	stack[top++] = 0;
+	while (top > 0) {
+		const BVHNode & n = nodes[stack[--top]];
+		if (!n.box.inside(p)) continue;
+		if (n.numTriangles > 0) {
+			nodeRtn = ref(&n - &nodes[0]);
+			return true;
+		}
+		stack[top++] = n.first + 1;
+		stack[top++] = n.first;
+	}
+	return false;
+}
+
+// Nearest exact hit along a ray, or of a sphere swept along it (boxes grown
+// by the radius).  Both children are tested and the nearer one is visited
+// first; a node entered beyond the best hit so far is skipped when it comes
+// off the stack.
+//
+bool BVH::sweep(const Ray & ray, float radius, OctreeHit & hit, float tMin, float tMax) {
+	hit.distance = tMax;
+	hit.triangle = -1;
+	hit.node = -1;
+	if (nodes.size() == 0) return false;
+
+	int stackNode[maxStack];
+	float stackEntry[maxStack];
+	int top = 0;
+	float entry;
+	if (intersectBox(nodes[0].box, ray, radius, tMin, hit.distance, entry)) {
+		stackNode[top] = 0;
+		stackEntry[top++] = entry;
+	}
+	while (top > 0) {
+		top--;
+		if (stackEntry[top] >= hit.distance) continue;
+		int node = stackNode[top];
+		const BVHNode & n = nodes[node];
+		if (n.numTriangles > 0) {
+			for (int i = n.first; i < n.first + n.numTriangles; i++) {
+				bool bHit = radius > 0 ? sweepTriangle(mesh, ray, radius, indices[i], tMin, hit) : hitTriangle(mesh, ray, indices[i], tMin, hit);
+				if (bHit) hit.node = node;
+			}
+			continue;
+		}
+
+		float entryA, entryB;
+		bool hitA = intersectBox(nodes[n.first].box, ray, radius, tMin, hit.distance, entryA);
+		bool hitB = intersectBox(nodes[n.first + 1].box, ray, radius, tMin, hit.distance, entryB);
+		if (hitA && hitB) {
+			int nearChild = entryA <= entryB ? n.first : n.first + 1;
+			stackNode[top] = nearChild ^ n.first ^ (n.first + 1);		// far child first
+			stackEntry[top++] = std::max(entryA, entryB);
+			stackNode[top] = nearChild;
+			stackEntry[top++] = std::min(entryA, entryB);
+		}
+		else if (hitA || hitB) {
+			stackNode[top] = hitA ? n.first : n.first + 1;
+			stackEntry[top++] = hitA ? entryA : entryB;
+		}
+	}
+	if (hit.node < 0) return false;
+
+	Vector3 o = ray.origin;
+	Vector3 d = ray.direction;
+	hit.point = ofVec3f(o.x(), o.y(), o.z()) + ofVec3f(d.x(), d.y(), d.z()) * hit.distance;
+	return true;
+}
+
+// every leaf the ray passes through, in tree order
+//
+bool BVH::intersect(const Ray & ray, vector<NodeRef> & refs) {
+	refs.clear();
+	if (nodes.size() == 0) return false;
+	int stack[maxStack];
+	int top = 0;
+	stack[top++] = 0;
+	while (top > 0) {
+		int node = stack[--top];
+		const BVHNode & n = nodes[node];
+		if (!n.box.intersect(ray, -1000, 1000)) continue;
+		if (n.numTriangles > 0) {
+			refs.push_back(ref(node));
+			continue;
+		}
+		stack[top++] = n.first + 1;
+		stack[top++] = n.first;
+	}
+	return refs.size() > 0;
+}
+
+// Vertices inside a pick cone: the corners of the triangles in the leaves
+// the cone reaches, each vertex once
+//
+int BVH::intersect(const PickCone & cone, vector<PickPoint> & points) {
+	points.clear();
+	if (nodes.size() == 0) return 0;
+	const vector<glm::vec3> & verts = mesh.getVertices();
+	int stack[maxStack];
+	int top = 0;
+	stack[top++] = 0;
+	while (top > 0) {
+		const BVHNode & n = nodes[stack[--top]];
+		if (!cone.intersects(n.box)) continue;
+		if (n.numTriangles == 0) {
+			stack[top++] = n.first + 1;
+			stack[top++] = n.first;
+			continue;
+		}
+		for (int i = n.first; i < n.first + n.numTriangles; i++) {
+			for (int c = 0; c < 3; c++) {
+				int v = mesh.getIndex(3 * indices[i] + c);
+				PickPoint pick;
+				if (!cone.contains(verts[v], pick.depth)) continue;
+				pick.point = verts[v];
+				pick.vertex = v;
+				points.push_back(pick);
+			}
+		}
+	}
+	sortPicks(points);
+	return points.size();
+}
+
+// gather the node boxes for the debug views once per build
+//
+void BVH::updateBoxLines() {
+	if (boxLines.revision == revision) return;
+	boxLines.begin(nodes.size());
+	if (nodes.size()) addBoxes(0, 0);
+	boxLines.end(revision);
+}
+
+void BVH::addBoxes(int node, int level) {
+	const BVHNode & n = nodes[node];
+	boxLines.add(n.box, level, n.numTriangles > 0);
+	if (n.numTriangles > 0) return;
+	addBoxes(n.first, level + 1);
+	addBoxes(n.first + 1, level + 1);
+}
+
+size_t BVH::memoryUsage() const {
+	return nodes.size() * sizeof(BVHNode) + indices.size() * sizeof(int);
+}
+
+int BVH::depth(int node) const {
+	if (nodes.size() == 0) return 0;
+	const BVHNode & n = nodes[node];
+	if (n.numTriangles > 0) return 1;
+	return 1 + std::max(depth(n.first), depth(n.first + 1));
+}
@@ -0,0 +1,63 @@
+#pragma once
+#include "ofMain.h"
+#include "SpatialIndex.h"
+#include "BoxLines.h"
+
+//  Node of the BVH.  Interior nodes have numTriangles == 0 and their two
+//  children at first and first + 1; leaves own the run of BVH::indices
+//  starting at first.
+//
+class BVHNode {
+public:
+	Box box;
+	int first;
+	int numTriangles;
+};
+
+//  Bounding volume hierarchy over the terrain triangles, split with the
+//  surface area heuristic over binned centroids.  Unlike the octree it adapts
+//  to the surface: flat plains end up in a few large leaves and rough areas
+//  like crater rims get split further.
+//
+class BVH : public SpatialIndex {
+public:
+	void create(const ofMesh & mesh);
+
+	bool intersect(const ofVec3f &, NodeRef & nodeRtn) override;
+	bool intersect(const Ray & ray, OctreeHit & hit, float tMin = 0, float tMax = FLT_MAX) override {
+		return sweep(ray, 0, hit, tMin, tMax);
+	}
+	bool sweep(const Ray &, float radius, OctreeHit & hit, float tMin = 0, float tMax = FLT_MAX) override;
+	using SpatialIndex::sweep;
+	bool intersect(const Ray &, vector<NodeRef> & refs) override;
+	int intersect(const PickCone & cone, vector<PickPoint> & points) override;
+	NodeRef ref(int node) const;
+
+	void draw(int numLevels, int level) override { updateBoxLines(); boxLines.draw(level, numLevels); }
+	void drawLeafNodes() override { updateBoxLines(); boxLines.drawLeaves(); }
+	void updateBoxLines();
+	void addBoxes(int node, int level);
+	int numNodes() const override { return nodes.size(); }
+	size_t memoryUsage() const override;
+	int depth(int node = 0) const;
+
+	// build parameters.  A node becomes a leaf when splitting it is not
+	// cheaper than testing its triangles, it holds minLeafSize triangles or
+	// fewer, or it is maxDepth deep.  Costs are relative to one triangle test.
+	//
+	int numBins = 16;
+	int minLeafSize = 2;
+	int maxLeafSize = 16;
+	float traversalCost = 1.0;
+	static const int maxDepth = 60;
+	static const int maxStack = maxDepth + 2;
+
+	ofMesh mesh;
+	vector<BVHNode> nodes;
+	vector<int> indices;			// triangle ids, leaf runs in tree order
+	int revision = 0;				// bumped by every create()
+	BoxLines boxLines;				// node outlines for the debug views
+
+private:
+	void split(int node, int depth, const vector<glm::vec3> & triMin, const vector<glm::vec3> & triMax, const vector<glm::vec3> & centroids);
+};
@@ -0,0 +1,112 @@
+#include "Box8.h"
+#include <cmath>
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define BOX8_SSE2
+#endif
+
+// Per axis the ray's sign picks which side of every box it enters through,
+// so no per box select is needed: the near and far planes of all eight boxes
+// are two rows of the arrays.  The radius moves the ray origin instead of
+// the planes (away from the near side, towards the far side).  A box is hit
+// when the slab intervals overlap (max of the entries <= min of the exits)
+// and that overlap meets (t0, t1), exactly as in Box::intersect.
+//
+#if defined(__AVX__)
+
+int Box8::intersect(const Ray & ray, float radius, float t0, float t1, float tEntry[8]) const {
+	__m256 tmin = _mm256_set1_ps(-INFINITY);
+	__m256 tmax = _mm256_set1_ps(INFINITY);
+	for (int k = 0; k < 3; k++) {
+		const float * nearSide = ray.sign[k] ? hi[k] : lo[k];
+		const float * farSide = ray.sign[k] ? lo[k] : hi[k];
+		float pad = ray.sign[k] ? -radius : radius;
+		__m256 oNear = _mm256_set1_ps(ray.origin[k] + pad);
+		__m256 oFar = _mm256_set1_ps(ray.origin[k] - pad);
+		__m256 inv = _mm256_set1_ps(ray.inv_direction[k]);
+		__m256 tNear = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(nearSide), oNear), inv);
+		__m256 tFar = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(farSide), oFar), inv);
+
+		// the running bound is the second operand, so a NaN slab (ray in the
+		// plane of a face it runs parallel to) leaves it unchanged
+		//
+		tmin = _mm256_max_ps(tNear, tmin);
+		tmax = _mm256_min_ps(tFar, tmax);
+	}
+	__m256 overlap = _mm256_cmp_ps(tmin, tmax, _CMP_LE_OQ);
+	__m256 before = _mm256_cmp_ps(tmin, _mm256_set1_ps(t1), _CMP_LT_OQ);
+	__m256 after = _mm256_cmp_ps(tmax, _mm256_set1_ps(t0), _CMP_GT_OQ);
+	int mask = _mm256_movemask_ps(_mm256_and_ps(overlap, _mm256_and_ps(before, after)));
+	_mm256_storeu_ps(tEntry, _mm256_max_ps(tmin, _mm256_set1_ps(t0)));
+	return mask;
+}
+
+const char * Box8::kernel() { return "avx"; }
+
+#elif defined(BOX8_SSE2)
+
+int Box8::intersect(const Ray & ray, float radius, float t0, float t1, float tEntry[8]) const {
+	__m128 tmin[2] = { _mm_set1_ps(-INFINITY), _mm_set1_ps(-INFINITY) };
+	__m128 tmax[2] = { _mm_set1_ps(INFINITY), _mm_set1_ps(INFINITY) };
+	for (int k = 0; k < 3; k++) {
+		const float * nearSide = ray.sign[k] ? hi[k] : lo[k];
+		const float * farSide = ray.sign[k] ? lo[k] : hi[k];
+		float pad = ray.sign[k] ? -radius : radius;
+		__m128 oNear = _mm_set1_ps(ray.origin[k] + pad);
+		__m128 oFar = _mm_set1_ps(ray.origin[k] - pad);
+		__m128 inv = _mm_set1_ps(ray.inv_direction[k]);
+		for (int h = 0; h < 2; h++) {
+			__m128 tNear = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(nearSide + 4 * h), oNear), inv);
+			__m128 tFar = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(farSide + 4 * h), oFar), inv);
+			tmin[h] = _mm_max_ps(tNear, tmin[h]);
+			tmax[h] = _mm_min_ps(tFar, tmax[h]);
+		}
+	}
+	int mask = 0;
+	for (int h = 0; h < 2; h++) {
+		__m128 overlap = _mm_cmple_ps(tmin[h], tmax[h]);
+		__m128 before = _mm_cmplt_ps(tmin[h], _mm_set1_ps(t1));
+		__m128 after = _mm_cmpgt_ps(tmax[h], _mm_set1_ps(t0));
+		mask |= _mm_movemask_ps(_mm_and_ps(overlap, _mm_and_ps(before, after))) << (4 * h);
+		_mm_storeu_ps(tEntry + 4 * h, _mm_max_ps(tmin[h], _mm_set1_ps(t0)));
+	}
+	return mask;
+}
+
+const char * Box8::kernel() { return "sse2"; }
+
+#else
+
+int Box8::intersect(const Ray & ray, float radius, float t0, float t1, float tEntry[8]) const {
+	float tmin[8], tmax[8];
+	for (int i = 0; i < 8; i++) {
+		tmin[i] = -INFINITY;
+		tmax[i] = INFINITY;
+	}
+	for (int k = 0; k < 3; k++) {
+		const float * nearSide = ray.sign[k] ? hi[k] : lo[k];
+		const float * farSide = ray.sign[k] ? lo[k] : hi[k];
+		float pad = ray.sign[k] ? -radius : radius;
+		float oNear = ray.origin[k] + pad;
+		float oFar = ray.origin[k] - pad;
+		float inv = ray.inv_direction[k];
+		for (int i = 0; i < 8; i++) {
+			float tNear = (nearSide[i] - oNear) * inv;
+			float tFar = (farSide[i] - oFar) * inv;
+			tmin[i] = tNear > tmin[i] ? tNear : tmin[i];
+			tmax[i] = tFar < tmax[i] ? tFar : tmax[i];
+		}
+	}
+	int mask = 0;
+	for (int i = 0; i < 8; i++) {
+		if (tmin[i] <= tmax[i] && tmin[i] < t1 && tmax[i] > t0) mask |= 1 << i;
+		tEntry[i] = tmin[i] > t0 ? tmin[i] : t0;
+	}
+	return mask;
+}
+
+const char * Box8::kernel() { return "scalar"; }
+
+#endif
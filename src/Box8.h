@@ -0,0 +1,22 @@
+#pragma once
+#include "ray.h"
+
+//  Eight axis aligned boxes stored as structure of arrays (lo[axis][box],
+//  hi[axis][box]), the children of one octree node.  intersect() tests one
+//  ray against all eight at once and returns a bit mask of the boxes it
+//  hits, with their entry distances (clamped to t0) in tEntry; a box is hit
+//  under the same conditions as in Box::intersect.  Boxes are grown by
+//  "radius" for swept spheres.
+//
+//  The kernel is picked at compile time: AVX when the compiler targets it
+//  (-mavx or -march=native), otherwise SSE2 (every x86-64 build), otherwise
+//  plain C++.  Unused slots may hold anything; mask them out of the result.
+//
+class Box8 {
+public:
+	float lo[3][8];
+	float hi[3][8];
+
+	int intersect(const Ray & ray, float radius, float t0, float t1, float tEntry[8]) const;
+	static const char * kernel();
+};
@@ -0,0 +1,103 @@
+#include "BoxLines.h"
+#include "SpatialIndex.h"
+
+// the 12 edges of a box as pairs of corners; corner i has the high x, y, z
+// where bits 0, 1, 2 of i are set
+//
+static const int boxEdges[24] = {
+	0, 1, 2, 3, 4, 5, 6, 7,
+	0, 2, 1, 3, 4, 6, 5, 7,
+	0, 4, 1, 5, 2, 6, 3, 7,
+};
+
+// begin:  start over, with room for "size" boxes
+//
+void BoxLines::begin(int size) {
+	corners.clear();
+	colors.clear();
+	levels.clear();
+	levelColors.clear();
+	leaves.clear();
+	corners.reserve(8 * size);
+	colors.reserve(8 * size);
+	numBoxes = 0;
+}
+
+void BoxLines::add(const Box & box, int level, bool bLeaf) {
+	const Vector3 & lo = box.parameters[0];
+	const Vector3 & hi = box.parameters[1];
+	ofIndexType base = corners.size();
+	while (level >= (int)levels.size()) {
+		levelColors.push_back(SpatialIndex::levelColor(levels.size()));
+		levels.push_back(vector<ofIndexType>());
+	}
+	for (int i = 0; i < 8; i++) {
+		corners.push_back(glm::vec3(i & 1 ? hi.x() : lo.x(), i & 2 ? hi.y() : lo.y(), i & 4 ? hi.z() : lo.z()));
+		colors.push_back(levelColors[level]);
+	}
+	for (int e = 0; e < 24; e++) levels[level].push_back(base + boxEdges[e]);
+	if (bLeaf) {
+		for (int e = 0; e < 24; e++) leaves.push_back(base + boxEdges[e]);
+	}
+	numBoxes++;
+}
+
+// end:  lay the levels out one after the other, then the leaves, and upload
+//
+void BoxLines::end(int treeRevision) {
+	vector<ofIndexType> edges;
+	edges.reserve(24 * numBoxes + leaves.size());
+	levelFirst.clear();
+	for (const vector<ofIndexType> & level : levels) {
+		levelFirst.push_back(edges.size());
+		edges.insert(edges.end(), level.begin(), level.end());
+	}
+	levelFirst.push_back(edges.size());
+	leafFirst = edges.size();
+	leafCount = leaves.size();
+	edges.insert(edges.end(), leaves.begin(), leaves.end());
+
+	vbo.clear();
+	if (!corners.empty()) {
+		vbo.setVertexData(corners.data(), corners.size(), GL_STATIC_DRAW);
+		vbo.setColorData(colors.data(), colors.size(), GL_STATIC_DRAW);
+		vbo.setIndexData(edges.data(), edges.size(), GL_STATIC_DRAW);
+	}
+	revision = treeRevision;
+
+	// the buffers hold it all now
+	//
+	vector<glm::vec3>().swap(corners);
+	vector<ofFloatColor>().swap(colors);
+	vector<vector<ofIndexType>>().swap(levels);
+	levelColors.clear();
+	vector<ofIndexType>().swap(leaves);
+}
+
+// draw the boxes of levels "level" to numLevels - 1 in their level colors
+//
+void BoxLines::draw(int level, int numLevels) {
+	int last = (int)levelFirst.size() - 1;
+	level = ofClamp(level, 0, last);
+	numLevels = ofClamp(numLevels, level, last);
+	int count = levelFirst[numLevels] - levelFirst[level];
+	if (count > 0) vbo.drawElements(GL_LINES, count, levelFirst[level]);
+}
+
+// draw the leaves in the current color
+//
+void BoxLines::drawLeaves() {
+	if (leafCount == 0) return;
+	vbo.disableColors();
+	vbo.drawElements(GL_LINES, leafCount, leafFirst);
+	vbo.enableColors();
+}
+
+void BoxLines::clear() {
+	begin(0);
+	levelFirst.clear();
+	leafFirst = 0;
+	leafCount = 0;
+	vbo.clear();
+	revision = -1;
+}
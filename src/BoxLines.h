@@ -0,0 +1,37 @@
+#pragma once
+#include "ofMain.h"
+#include "box.h"
+
+//  Outlines of a tree's node boxes in one line list VBO, for the debug
+//  views.  Every box added gets its 8 corners in the level's color and 24
+//  edge indices; end() sorts the edges by level, so the boxes of any span
+//  of levels are one range of the index buffer and one draw call, and
+//  appends a second copy of the leaves' edges (over the same corners) for
+//  the leaf view.  Build it once per tree: revision is the tree revision
+//  it was made from.
+//
+class BoxLines {
+public:
+	void begin(int size = 0);
+	void add(const Box & box, int level, bool bLeaf);
+	void end(int revision);
+
+	void draw(int level, int numLevels);
+	void drawLeaves();
+	bool ready() const { return revision >= 0; }
+	void clear();
+
+	int revision = -1;
+	int numBoxes = 0;
+
+private:
+	vector<glm::vec3> corners;
+	vector<ofFloatColor> colors;
+	vector<vector<ofIndexType>> levels;		// edges of each level while building
+	vector<ofFloatColor> levelColors;
+	vector<ofIndexType> leaves;
+	vector<int> levelFirst;					// first index of every level, and the end
+	int leafFirst = 0;
+	int leafCount = 0;
+	ofVbo vbo;
+};
@@ -0,0 +1,138 @@
+#include "HeightField.h"
+#include <cfloat>
+
+// create:  rasterize every triangle onto the grid from above.  Each sample
+//          keeps the highest surface over it (and that triangle's normal)
+//          and the lowest one; where they differ by more than a cell the
+//          surface folds over itself there and the sample is an overhang.
+//
+void HeightField::create(const ofMesh & mesh, int resolution) {
+	const vector<glm::vec3> & verts = mesh.getVertices();
+	glm::vec3 lo(FLT_MAX), hi(-FLT_MAX);
+	for (unsigned int i = 0; i < verts.size(); i++) {
+		lo = glm::min(lo, verts[i]);
+		hi = glm::max(hi, verts[i]);
+	}
+	heights.clear();
+	normals.clear();
+	types.clear();
+	cols = rows = 0;
+	if (verts.size() == 0 || resolution < 1) return;
+
+	cellSize = std::max(hi.x - lo.x, hi.z - lo.z) / resolution;
+	if (cellSize <= 0) return;
+	x0 = lo.x;
+	z0 = lo.z;
+	cols = (int)ceil((hi.x - lo.x) / cellSize) + 1;
+	rows = (int)ceil((hi.z - lo.z) / cellSize) + 1;
+	heights.assign(cols * rows, -FLT_MAX);
+	normals.assign(cols * rows, glm::vec3(0, 1, 0));
+	vector<float> lowest(cols * rows, FLT_MAX);
+
+	int numTriangles = mesh.getNumIndices() / 3;
+	for (int t = 0; t < numTriangles; t++) {
+		const glm::vec3 & v0 = verts[mesh.getIndex(t * 3)];
+		const glm::vec3 & v1 = verts[mesh.getIndex(t * 3 + 1)];
+		const glm::vec3 & v2 = verts[mesh.getIndex(t * 3 + 2)];
+		int i0 = std::max(0, (int)ceil((std::min(v0.x, std::min(v1.x, v2.x)) - x0) / cellSize));
+		int i1 = std::min(cols - 1, (int)floor((std::max(v0.x, std::max(v1.x, v2.x)) - x0) / cellSize));
+		int j0 = std::max(0, (int)ceil((std::min(v0.z, std::min(v1.z, v2.z)) - z0) / cellSize));
+		int j1 = std::min(rows - 1, (int)floor((std::max(v0.z, std::max(v1.z, v2.z)) - z0) / cellSize));
+
+		// signed area of the x/z projection; an edge-on triangle is a vertical
+		// wall, which a heightfield cannot represent
+		//
+		float area = (v1.x - v0.x) * (v2.z - v0.z) - (v2.x - v0.x) * (v1.z - v0.z);
+		if (fabs(area) < 1e-12f) {
+			for (int j = j0; j <= j1; j++) {
+				for (int i = i0; i <= i1; i++) {
+					lowest[j * cols + i] = -FLT_MAX;
+				}
+			}
+			continue;
+		}
+		glm::vec3 normal = glm::normalize(glm::cross(v1 - v0, v2 - v0));
+		if (normal.y < 0) normal = normal * -1.0f;
+
+		const float eps = 1e-6f;
+		for (int j = j0; j <= j1; j++) {
+			for (int i = i0; i <= i1; i++) {
+				float x = x0 + i * cellSize;
+				float z = z0 + j * cellSize;
+				float b1 = ((x - v0.x) * (v2.z - v0.z) - (v2.x - v0.x) * (z - v0.z)) / area;
+				float b2 = ((v1.x - v0.x) * (z - v0.z) - (x - v0.x) * (v1.z - v0.z)) / area;
+				float b0 = 1 - b1 - b2;
+				if (b0 < -eps || b1 < -eps || b2 < -eps) continue;
+				float y = b0 * v0.y + b1 * v1.y + b2 * v2.y;
+				int s = j * cols + i;
+				if (y > heights[s]) {
+					heights[s] = y;
+					normals[s] = normal;
+				}
+				lowest[s] = std::min(lowest[s], y);
+			}
+		}
+	}
+
+	types.resize(cols * rows);
+	for (int s = 0; s < cols * rows; s++) {
+		if (heights[s] == -FLT_MAX) types[s] = Hole;
+		else if (heights[s] - lowest[s] > cellSize) types[s] = Overhang;
+		else types[s] = Surface;
+	}
+}
+
+// ground:  bilinear height and normal of the surface under (x, z).  Returns
+//          false outside the grid or when any corner of the cell is not a
+//          plain surface sample.
+//
+bool HeightField::ground(float x, float z, float & height, ofVec3f & normal) const {
+	if (cols < 2 || rows < 2) return false;
+	float fx = (x - x0) / cellSize;
+	float fz = (z - z0) / cellSize;
+	if (!(fx >= 0 && fz >= 0 && fx <= cols - 1 && fz <= rows - 1)) return false;
+	int i = std::min((int)fx, cols - 2);
+	int j = std::min((int)fz, rows - 2);
+	fx -= i;
+	fz -= j;
+
+	int s = j * cols + i;
+	if (types[s] | types[s + 1] | types[s + cols] | types[s + cols + 1]) return false;
+
+	float w00 = (1 - fx) * (1 - fz);
+	float w10 = fx * (1 - fz);
+	float w01 = (1 - fx) * fz;
+	float w11 = fx * fz;
+	height = w00 * heights[s] + w10 * heights[s + 1] + w01 * heights[s + cols] + w11 * heights[s + cols + 1];
+	glm::vec3 n = normals[s] * w00 + normals[s + 1] * w10 + normals[s + cols] * w01 + normals[s + cols + 1] * w11;
+	normal = glm::normalize(n);
+	return true;
+}
+
+// invalidate:  flag the samples under the x/z rectangle (and the ones
+//              bordering it, whose cells reach into it) as stale
+//
+void HeightField::invalidate(float xMin, float zMin, float xMax, float zMax) {
+	if (cols < 2 || rows < 2) return;
+	int i0 = std::max(0, (int)floor((xMin - x0) / cellSize));
+	int i1 = std::min(cols - 1, (int)ceil((xMax - x0) / cellSize));
+	int j0 = std::max(0, (int)floor((zMin - z0) / cellSize));
+	int j1 = std::min(rows - 1, (int)ceil((zMax - z0) / cellSize));
+	for (int j = j0; j <= j1; j++) {
+		for (int i = i0; i <= i1; i++) {
+			types[j * cols + i] = Stale;
+		}
+	}
+}
+
+size_t HeightField::memoryUsage() const {
+	return heights.size() * sizeof(float) + normals.size() * sizeof(glm::vec3) + types.size();
+}
+
+int HeightField::numFlagged() const {
+	int count = 0;
+	for (unsigned int i = 0; i < types.size(); i++) {
+		if (types[i] != Surface) count++;
+	}
+	return count;
+}
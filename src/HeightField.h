@@ -0,0 +1,36 @@
+#pragma once
+#include "ofMain.h"
+
+//  Regular grid of terrain heights and normals over the x/z plane, baked from
+//  the terrain mesh.  ground() answers "how high is the surface under (x, z)"
+//  with one bilinear lookup instead of a ray cast.  Samples the surface
+//  covers more than once (overhangs, caves, vertical walls) or not at all
+//  (holes, outside the mesh) are flagged, and queries touching them fail so
+//  the caller can fall back to a ray down the spatial index.  Terrain that
+//  deforms after the bake is handed to the index the same way: invalidate()
+//  flags the samples under the changed area as stale.
+//
+class HeightField {
+public:
+	typedef enum { Surface, Hole, Overhang, Stale } SampleType;
+
+	// bake the top surface of "mesh"; resolution is the number of cells along
+	// the longer side of its x/z bounds
+	//
+	void create(const ofMesh & mesh, int resolution = 512);
+	bool ground(float x, float z, float & height, ofVec3f & normal) const;
+	void invalidate(float xMin, float zMin, float xMax, float zMax);
+
+	size_t memoryUsage() const;
+	int numFlagged() const;
+
+	int cols = 0;
+	int rows = 0;
+	float x0 = 0;
+	float z0 = 0;
+	float cellSize = 1;
+
+	vector<float> heights;			// cols * rows samples, row major in z
+	vector<glm::vec3> normals;
+	vector<unsigned char> types;	// SampleType of every sample
+};
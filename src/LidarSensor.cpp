@@ -0,0 +1,112 @@
+#include "LidarSensor.h"
+
+// setup:  lay out the scan pattern and split it into bands, a few per worker
+//         so the pool can even out bands that cost more (beams that travel
+//         far over rough terrain)
+//
+void LidarSensor::setup(int numRows, int numCols, float minElev, float maxElev, float range) {
+	end();
+	rows = numRows;
+	cols = numCols;
+	minElevation = minElev;
+	maxElevation = maxElev;
+	maxRange = range;
+
+	directions.resize(rows * cols);
+	for (int r = 0; r < rows; r++) {
+		float elevation = ofDegToRad(rows > 1 ? ofLerp(minElevation, maxElevation, r / (float)(rows - 1)) : minElevation);
+		for (int c = 0; c < cols; c++) {
+			float azimuth = TWO_PI * c / cols;
+			directions[r * cols + c] = glm::vec3(cos(elevation) * cos(azimuth), sin(elevation), cos(elevation) * sin(azimuth));
+		}
+	}
+	ranges.assign(rows * cols, 0);
+	scanRanges.assign(rows * cols, 0);
+	points.clear();
+
+	pool.reset(new TaskPool(numThreads));
+	int numBands = std::min(rows, 4 * pool->size());
+	bands.resize(numBands);
+	for (int b = 0; b < numBands; b++) {
+		bands[b].firstRow = rows * b / numBands;
+		bands[b].numRows = rows * (b + 1) / numBands - bands[b].firstRow;
+		bands[b].rays.reserve(bands[b].numRows * cols);
+	}
+}
+
+// start a scan from "from" against "terrain"; a scan still running is
+// finished first
+//
+void LidarSensor::begin(SpatialIndex & terrain, const ofVec3f & from) {
+	end();
+	if (bands.empty()) return;
+	index = &terrain;
+	origin = from;
+	started = ofGetElapsedTimeMicros();
+	bScanning = true;
+	pendingBands = bands.size();
+	for (Band & band : bands) {
+		Band * b = &band;
+		pool->run([this, b]() { trace(*b); });
+	}
+}
+
+void LidarSensor::trace(Band & band) {
+	band.rays.clear();
+	int first = band.firstRow * cols;
+	int count = band.numRows * cols;
+	for (int i = first; i < first + count; i++) {
+		band.rays.add(origin, directions[i]);
+	}
+	index->intersect(band.rays, band.hits, 0, maxRange);
+
+	band.points.clear();
+	for (int i = 0; i < count; i++) {
+		const OctreeHit & hit = band.hits[i];
+		scanRanges[first + i] = hit.node >= 0 ? hit.distance : 0;
+		if (hit.node >= 0) band.points.push_back(hit.point);
+	}
+	band.finished = ofGetElapsedTimeMicros();
+	pendingBands--;
+}
+
+// publish the running scan if all its bands are done, without waiting
+//
+bool LidarSensor::poll() {
+	if (!bScanning || pendingBands > 0) return false;
+	end();
+	return true;
+}
+
+// wait for the running scan (helping the pool) and publish it
+//
+void LidarSensor::end() {
+	if (!bScanning) return;
+	uint64_t start = ofGetElapsedTimeMicros();
+	pool->wait();
+	waitMs = (ofGetElapsedTimeMicros() - start) / 1000.0;
+	bScanning = false;
+
+	uint64_t finished = started;
+	points.clear();
+	for (Band & band : bands) {
+		finished = std::max(finished, band.finished);
+		points.insert(points.end(), band.points.begin(), band.points.end());
+	}
+	scanMs = (finished - started) / 1000.0;
+	ranges.swap(scanRanges);
+	scanOrigin = origin;
+
+	cloud.clear();
+	cloud.setMode(OF_PRIMITIVE_POINTS);
+	cloud.addVertices(points);
+}
+
+// the returns of the last scan
+//
+void LidarSensor::draw() {
+	if (points.empty()) return;
+	glPointSize(2);
+	ofSetColor(ofColor::cyan);
+	cloud.draw();
+}
@@ -0,0 +1,71 @@
+#pragma once
+#include "ofMain.h"
+#include "SpatialIndex.h"
+#include "TaskPool.h"
+#include <atomic>
+
+//  Scanning range sensor (lidar, or a radar altimeter with a narrow pattern)
+//  riding on the lander.  "rows" beams spread evenly between minElevation
+//  and maxElevation (degrees, negative below the horizon) are swept through
+//  "cols" azimuth steps of a full turn, all from one origin.  Every scan
+//  fills a rows x cols range image (row major, 0 where there is no return
+//  within maxRange) and a point cloud of the returns.
+//
+//  A scan runs on the sensor's own task pool, a band of rows per task, each
+//  band traced as one ray batch in azimuth order so neighboring beams share
+//  packets.  begin() starts a scan and end() waits for it and publishes the
+//  results; poll() publishes it only if it is done, so the app can keep the
+//  last finished scan while the next one takes as many frames as it needs.
+//  The terrain index must not change while a scan runs.
+//
+class LidarSensor {
+public:
+	~LidarSensor() { end(); }
+
+	void setup(int rows, int cols, float minElevation, float maxElevation, float maxRange);
+	void begin(SpatialIndex & index, const ofVec3f & origin);
+	void end();
+	bool poll();
+	bool busy() const { return bScanning; }
+	bool ready() const { return !bands.empty(); }
+	void draw();
+
+	int rows = 64;
+	int cols = 1024;
+	float minElevation = -80;
+	float maxElevation = -5;
+	float maxRange = 30;
+	int numThreads = 0;				// pool workers, 0 = one per hardware thread
+
+	// the last finished scan.  scanMs runs from begin() until the last band
+	// was done, waitMs is how long end() had to block for it.
+	//
+	vector<float> ranges;
+	vector<glm::vec3> points;
+	ofVec3f scanOrigin;
+	float scanMs = 0;
+	float waitMs = 0;
+
+private:
+	class Band {
+	public:
+		int firstRow;
+		int numRows;
+		RayBatch rays;
+		vector<OctreeHit> hits;
+		vector<glm::vec3> points;
+		uint64_t finished;
+	};
+	void trace(Band & band);
+
+	vector<glm::vec3> directions;	// rows * cols unit beam directions
+	vector<Band> bands;
+	vector<float> scanRanges;		// range image being filled
+	SpatialIndex * index = nullptr;
+	ofVec3f origin;
+	uint64_t started = 0;
+	bool bScanning = false;
+	std::atomic<int> pendingBands{ 0 };
+	ofVboMesh cloud;
+	unique_ptr<TaskPool> pool;
+};
@@ -1,75 +1,46 @@
 #include "Octree.h"
+#include "Box8.h"
+#include <fstream>
+#ifdef TARGET_WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 
 
-// draw Octree (recursively)
+// updateBoxLines:  gather the node boxes for the debug views, if the tree
+//                  changed since they were last gathered
 //
-void Octree::draw(TreeNode & node, int numLevels, int level) {
-	if (level >= numLevels) return;
-	switch (level) {
-	case 0:
-		ofSetColor(ofColor::lightBlue);
-		break;
-	case 1:
-		ofSetColor(ofColor::red);
-		break;
-	case 2:
-		ofSetColor(ofColor::green);
-		break;
-	case 3:
-		ofSetColor(ofColor::brown);
-		break;
-	case 4:
-		ofSetColor(ofColor::yellow);
-		break;
-	case 5:
-		ofSetColor(ofColor::blue);
-		break;
-	case 6:
-		ofSetColor(ofColor::pink);
-		break;
-	case 7:
-		ofSetColor(ofColor::orange);
-		break;
-	case 8:
-		ofSetColor(ofColor::white);
-		break;
-	default:
-		ofSetColor(ofColor::lightYellow);
-		break;
-	}
-	drawBox(node.box);
-	level++;
-	for (unsigned int i = 0; i < node.children.size(); i++) {
-		draw(node.children[i], numLevels, level);
+void Octree::updateBoxLines() {
+	if (boxLines.revision == revision) return;
+	boxLines.begin(numNodes());
+	if (bLinear) {
+		if (nodes.size() > 0) addBoxes(0, 0);
 	}
+	else addBoxes(root, 0);
+	boxLines.end(revision);
 }
 
-// draw only leaf Nodes
+// add the boxes of a subtree (recursively)
 //
-void Octree::drawLeafNodes(TreeNode & node) {
-	if (node.children.size() == 0) {
-		drawBox(node.box);
-	}
-	else {
-		for (unsigned int i = 0; i < node.children.size(); i++) {
-			drawLeafNodes(node.children[i]);
-		}
+void Octree::addBoxes(const TreeNode & node, int level) {
+	boxLines.add(node.box, level, node.children.size() == 0);
+	for (unsigned int i = 0; i < node.children.size(); i++) {
+		addBoxes(node.children[i], level + 1);
 	}
 }
 
-
-//draw a box from a "Box" class  
+// add the boxes of a flat subtree (recursively)
 //
-void Octree::drawBox(const Box &box) {
-	Vector3 min = box.parameters[0];
-	Vector3 max = box.parameters[1];
-	Vector3 size = max - min;
-	Vector3 center = size / 2 + min;
-	ofVec3f p = ofVec3f(center.x(), center.y(), center.z());
-	float w = size.x();
-	float h = size.y();
-	float d = size.z();
-	ofDrawBox(p, w, h, d);
+void Octree::addBoxes(int node, int level) {
+	const FlatNode & n = nodes[node];
+	boxLines.add(n.box, level, n.numChildren == 0);
+	for (int i = 0; i < n.numChildren; i++) {
+		addBoxes(n.firstChild + i, level + 1);
+	}
 }
 
 // return a Mesh Bounding Box for the entire Mesh
@@ -147,18 +118,690 @@ void Octree::subDivideBox8(const Box &box, vector<Box> & boxList) {
 	}
 }
 
-void Octree::create(const ofMesh & geo, int numLevels) {
+// uniqueVertices:  every vertex the mesh indices reference, once.  Vertices
+//                  at the same position (meshes split per face or per
+//                  material repeat them) are welded to the lowest id.
+//
+static void uniqueVertices(const ofMesh & mesh, vector<int> & ids) {
+	const vector<glm::vec3> & verts = mesh.getVertices();
+	ids.resize(mesh.getNumIndices());
+	for (unsigned int i = 0; i < ids.size(); i++) {
+		ids[i] = mesh.getIndex(i);
+	}
+	std::sort(ids.begin(), ids.end());
+	ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+
+	auto samePosition = [&](int a, int b) {
+		return verts[a].x == verts[b].x && verts[a].y == verts[b].y && verts[a].z == verts[b].z;
+	};
+	std::stable_sort(ids.begin(), ids.end(), [&](int a, int b) {
+		const glm::vec3 & u = verts[a];
+		const glm::vec3 & v = verts[b];
+		if (u.x != v.x) return u.x < v.x;
+		if (u.y != v.y) return u.y < v.y;
+		return u.z < v.z;
+	});
+	ids.erase(std::unique(ids.begin(), ids.end(), samePosition), ids.end());
+	std::sort(ids.begin(), ids.end());
+}
+
+// collapseChains (pointer layout):  merge every node that has one child with
+//                                   that child
+//
+int Octree::collapseChains(TreeNode & node) {
+	int count = 0;
+	while (node.children.size() == 1) {
+		TreeNode child = std::move(node.children[0]);
+		node = std::move(child);
+		count++;
+	}
+	for (unsigned int i = 0; i < node.children.size(); i++) {
+		count += collapseChains(node.children[i]);
+	}
+	return count;
+}
+
+OctreeBuildStats Octree::create(const ofMesh & geo, const OctreeBuildParams & params, OctreeBuildType type) {
 	// initialize octree structure
 	//
+	uint64_t start = ofGetElapsedTimeMicros();
 	mesh = geo;
+	release();
+	buildParams = params;
+
+	int numLevels = levelLimit(meshBounds(geo));
+
+	if (bLinear) {
+		if (type == MortonBuild) createMorton(numLevels);
+		else createFlat(numLevels);
+		int collapsed = params.collapseChains ? collapseChains() : 0;
+		int cuts = params.memoryBudget > 0 ? applyMemoryBudget(params.memoryBudget) : 0;
+		if (params.compactIndices) compactIndices();
+		linkNodes();
+		OctreeBuildStats stats = statistics();
+		stats.numLevels = numLevels;
+		stats.budgetCuts = cuts;
+		stats.collapsed = collapsed;
+		stats.buildMs = (ofGetElapsedTimeMicros() - start) / 1000.0;
+		return stats;
+	}
 
 	int level = 0;
+	root = TreeNode();
 	root.box = meshBounds(geo);
-	for (unsigned int i = 0; i < mesh.getNumIndices(); i++) {
-		root.points.push_back(mesh.getIndex(i));
+	uniqueVertices(mesh, root.points);
+
+	if (numThreads == 1) {
+		subdivide(mesh, root, numLevels, level);
+	}
+	else {
+		// the calling thread works too while it waits, so the pool gets one less
+		//
+		int workers = (numThreads > 0 ? numThreads : TaskPool::defaultThreads()) - 1;
+		TaskPool pool(workers > 0 ? workers : 1);
+		subdivideParallel(pool, mesh, root, numLevels, level);
+		pool.wait();
+	}
+	int collapsed = params.collapseChains ? collapseChains(root) : 0;
+	OctreeBuildStats stats = statistics();
+	stats.numLevels = numLevels;
+	stats.collapsed = collapsed;
+	stats.buildMs = (ofGetElapsedTimeMicros() - start) / 1000.0;
+	return stats;
+}
+
+// levelLimit:  depth limit of a build over "bounds": maxLevels, or fewer if
+//              the cells would get below minCellSize, and never past
+//              maxDepth, which the traversal stacks are sized for
+//
+int Octree::levelLimit(const Box & bounds) const {
+	int numLevels = std::min(buildParams.maxLevels, (int)maxDepth);
+	Vector3 size = bounds.max() - bounds.min();
+	float longest = std::max(size.x(), std::max(size.y(), size.z()));
+	if (buildParams.minCellSize > 0) {
+		int levels = 0;
+		while (levels < numLevels && longest / (1 << (levels + 1)) >= buildParams.minCellSize) levels++;
+		numLevels = levels;
+	}
+	return numLevels;
+}
+
+// createFlat:  build the flat layout directly by partitioning one shared index
+//              array in place.  The top parallelLevels levels are split first;
+//              the subtrees below them are built into their own node arrays
+//              (on the task pool when numThreads != 1) and appended in order,
+//              so the layout does not depend on the number of threads.
+//
+void Octree::createFlat(int numLevels) {
+	root = TreeNode();
+	root.box = meshBounds(mesh);
+	nodeStore.clear();
+	initPrimitives();
+	octants.resize(indexStore.size());
+
+	FlatNode rootNode;
+	rootNode.box = root.box;
+	rootNode.firstChild = -1;
+	rootNode.numChildren = 0;
+	rootNode.childMask = 0;
+	rootNode.level = 0;
+	rootNode.firstPoint = 0;
+	rootNode.numPoints = indexStore.size();
+	nodeStore.push_back(rootNode);
+
+	// split the top levels and collect the nodes whose subtrees are left to build
+	//
+	vector<int> frontier;
+	vector<int> frontierLevel;
+	vector<int> stack;
+	vector<int> stackLevel;
+	stack.push_back(0);
+	stackLevel.push_back(0);
+	while (stack.size() > 0) {
+		int node = stack.back();
+		int level = stackLevel.back();
+		stack.pop_back();
+		stackLevel.pop_back();
+		if (level >= numLevels || nodeStore[node].numPoints <= buildParams.maxLeafSize) continue;
+		if (level >= parallelLevels) {
+			frontier.push_back(node);
+			frontierLevel.push_back(level);
+			continue;
+		}
+		splitNode(nodeStore, node);
+		for (int i = nodeStore[node].numChildren - 1; i >= 0; i--) {
+			stack.push_back(nodeStore[node].firstChild + i);
+			stackLevel.push_back(level + 1);
+		}
+	}
+
+	vector<vector<FlatNode>> subtrees(frontier.size());
+	for (unsigned int i = 0; i < frontier.size(); i++) {
+		subtrees[i].push_back(nodeStore[frontier[i]]);
+	}
+	if (numThreads == 1) {
+		for (unsigned int i = 0; i < frontier.size(); i++) {
+			buildSubtree(subtrees[i], 0, numLevels, frontierLevel[i]);
+		}
+	}
+	else {
+		int workers = (numThreads > 0 ? numThreads : TaskPool::defaultThreads()) - 1;
+		TaskPool pool(workers > 0 ? workers : 1);
+		for (unsigned int i = 0; i < frontier.size(); i++) {
+			vector<FlatNode> * subtree = &subtrees[i];
+			int level = frontierLevel[i];
+			pool.run([this, subtree, numLevels, level]() {
+				buildSubtree(*subtree, 0, numLevels, level);
+			});
+		}
+		pool.wait();
+	}
+
+	// splice the subtrees in: subtree node k lands at nodes[offset + k]
+	//
+	for (unsigned int i = 0; i < frontier.size(); i++) {
+		vector<FlatNode> & subtree = subtrees[i];
+		int offset = nodeStore.size() - 1;
+		for (unsigned int k = 0; k < subtree.size(); k++) {
+			if (subtree[k].numChildren > 0) subtree[k].firstChild += offset;
+		}
+		nodeStore[frontier[i]] = subtree[0];
+		nodeStore.insert(nodeStore.end(), subtree.begin() + 1, subtree.end());
+		vector<FlatNode>().swap(subtree);
+	}
+
+	vector<unsigned char>().swap(octants);
+	if (primitives == TrianglePrimitives) fitTriangleBounds();
+	vector<glm::vec3>().swap(centroidStore);
+	nodes.set(nodeStore);
+	indices.set(indexStore);
+}
+
+// initPrimitives:  fill indexStore with the primitives the tree indexes and
+//                  point "centers" at the positions used to bucket them.  In
+//                  vertex mode that is every vertex the mesh uses, once, and
+//                  its position; in triangle mode every triangle id and its
+//                  centroid.
+//
+void Octree::initPrimitives() {
+	const vector<glm::vec3> & verts = mesh.getVertices();
+	if (primitives == TrianglePrimitives) {
+		int numTriangles = mesh.getNumIndices() / 3;
+		centroidStore.resize(numTriangles);
+		indexStore.resize(numTriangles);
+		for (int t = 0; t < numTriangles; t++) {
+			const glm::vec3 & v0 = verts[mesh.getIndex(t * 3)];
+			const glm::vec3 & v1 = verts[mesh.getIndex(t * 3 + 1)];
+			const glm::vec3 & v2 = verts[mesh.getIndex(t * 3 + 2)];
+			centroidStore[t] = (v0 + v1 + v2) / 3.0f;
+			indexStore[t] = t;
+		}
+		centers = centroidStore.data();
+		numCenters = numTriangles;
+	}
+	else {
+		uniqueVertices(mesh, indexStore);
+		centers = verts.data();
+		numCenters = verts.size();
+	}
+}
+
+// fitTriangleBounds:  grow every node box to hold the whole triangles under it,
+//                     not only their centroids.  Children always follow their
+//                     parent in nodeStore, so one reverse pass sees every
+//                     child before its parent.
+//
+void Octree::fitTriangleBounds() {
+	const vector<glm::vec3> & verts = mesh.getVertices();
+	for (int i = nodeStore.size() - 1; i >= 0; i--) {
+		FlatNode & node = nodeStore[i];
+		Vector3 lo = node.box.min();
+		Vector3 hi = node.box.max();
+		float bmin[3] = { lo.x(), lo.y(), lo.z() };
+		float bmax[3] = { hi.x(), hi.y(), hi.z() };
+		if (node.numChildren == 0) {
+			for (int p = node.firstPoint; p < node.firstPoint + node.numPoints; p++) {
+				for (int corner = 0; corner < 3; corner++) {
+					const glm::vec3 & v = verts[mesh.getIndex(indexStore[p] * 3 + corner)];
+					for (int k = 0; k < 3; k++) {
+						bmin[k] = std::min(bmin[k], v[k]);
+						bmax[k] = std::max(bmax[k], v[k]);
+					}
+				}
+			}
+		}
+		for (int c = node.firstChild; c < node.firstChild + node.numChildren; c++) {
+			const Box & child = nodeStore[c].box;
+			for (int k = 0; k < 3; k++) {
+				bmin[k] = std::min(bmin[k], child.parameters[0][k]);
+				bmax[k] = std::max(bmax[k], child.parameters[1][k]);
+			}
+		}
+		node.box = Box(Vector3(bmin[0], bmin[1], bmin[2]), Vector3(bmax[0], bmax[1], bmax[2]));
+	}
+}
+
+// applyMemoryBudget:  cut the tree down to "budget" bytes of nodes, cursor
+//                     links and indices (at the width compactIndices() will
+//                     leave them).  The root gets what the indices leave over and
+//                     every node passes what its children cost less on to
+//                     them in proportion to their point counts, so dense
+//                     regions keep their depth and sparse ones are cut first.
+//                     Kept nodes keep their order.  Returns the number of cuts.
+//
+int Octree::applyMemoryBudget(size_t budget) {
+	if (nodeStore.size() == 0) return 0;
+	size_t nodeCost = sizeof(FlatNode) + 7 * sizeof(int);		// node, parent link, 6 neighbor links
+	size_t fixed = indexStore.size() * (buildParams.compactIndices ? sizeof(uint16_t) : sizeof(int)) + nodeCost;
+	vector<double> share(nodeStore.size(), 0);
+	vector<char> keep(nodeStore.size(), 0);
+	share[0] = budget > fixed ? double(budget - fixed) : 0;
+	keep[0] = 1;
+	int cuts = 0;
+	for (size_t i = 0; i < nodeStore.size(); i++) {
+		FlatNode & node = nodeStore[i];
+		if (!keep[i] || node.numChildren == 0) continue;
+		double cost = node.numChildren * nodeCost;
+		if (share[i] < cost) {
+			node.firstChild = -1;
+			node.numChildren = 0;
+			node.childMask = 0;
+			cuts++;
+			continue;
+		}
+		double rest = share[i] - cost;
+		for (int c = node.firstChild; c < node.firstChild + node.numChildren; c++) {
+			keep[c] = 1;
+			share[c] = rest * nodeStore[c].numPoints / node.numPoints;
+		}
+	}
+	if (cuts > 0) compactNodes(keep);
+	return cuts;
+}
+
+// collapseChains:  merge every node that has a single child with that child.
+//                  The node takes over the child's box, level and children
+//                  (its point run is already the child's), so queries see
+//                  the same leaves one box test sooner.
+//
+int Octree::collapseChains() {
+	int collapsed = collapseChains(nodeStore);
+	if (collapsed > 0) {
+		nodeStore.shrink_to_fit();
+		nodes.set(nodeStore);
+	}
+	return collapsed;
+}
+
+int Octree::collapseChains(vector<FlatNode> & out) {
+	vector<char> keep(out.size(), 1);
+	int collapsed = 0;
+	for (size_t i = 0; i < out.size(); i++) {
+		if (!keep[i]) continue;
+		FlatNode & node = out[i];
+		while (node.numChildren == 1) {
+			int c = node.firstChild;
+			const FlatNode & child = out[c];
+			node.box = child.box;
+			node.level = child.level;
+			node.childMask = child.childMask;
+			node.numChildren = child.numChildren;
+			node.firstChild = child.firstChild;
+			keep[c] = 0;
+			collapsed++;
+		}
+	}
+	if (collapsed > 0) compactNodes(out, keep);
+	return collapsed;
+}
+
+// compactNodes:  drop the nodes not marked in "keep", keeping the order of
+//                the rest.  Every child run left must be kept whole.
+//
+void Octree::compactNodes(const vector<char> & keep) {
+	compactNodes(nodeStore, keep);
+	nodeStore.shrink_to_fit();
+	nodes.set(nodeStore);
+}
+
+void Octree::compactNodes(vector<FlatNode> & out, const vector<char> & keep) {
+	vector<int> remap(out.size(), -1);
+	int kept = 0;
+	for (size_t i = 0; i < out.size(); i++) {
+		if (keep[i]) remap[i] = kept++;
+	}
+	for (size_t i = 0; i < out.size(); i++) {
+		if (!keep[i]) continue;
+		FlatNode node = out[i];
+		if (node.numChildren > 0) node.firstChild = remap[node.firstChild];
+		out[remap[i]] = node;
+	}
+	out.resize(kept);
+}
+
+// compactIndices:  rewrite the leaf runs as 16 bit offsets from the lowest id
+//                  in each leaf.  The leaves partition the index array, so
+//                  every entry gets exactly one base; interior runs mix bases
+//                  and can no longer be read, which no query needs.  Returns
+//                  false, leaving the 32 bit indices, if a leaf spans too
+//                  many ids.
+//
+bool Octree::compactIndices() {
+	for (size_t i = 0; i < nodeStore.size(); i++) {
+		const FlatNode & node = nodeStore[i];
+		if (node.numChildren > 0 || node.numPoints == 0) continue;
+		const int * run = &indexStore[node.firstPoint];
+		int lo = *std::min_element(run, run + node.numPoints);
+		int hi = *std::max_element(run, run + node.numPoints);
+		if (hi - lo > 0xffff) return false;
+	}
+	offsetStore.resize(indexStore.size());
+	for (size_t i = 0; i < nodeStore.size(); i++) {
+		FlatNode & node = nodeStore[i];
+		if (node.numChildren > 0) continue;
+		node.firstChild = 0;
+		if (node.numPoints == 0) continue;
+		const int * run = &indexStore[node.firstPoint];
+		int base = *std::min_element(run, run + node.numPoints);
+		for (int p = node.firstPoint; p < node.firstPoint + node.numPoints; p++) {
+			offsetStore[p] = indexStore[p] - base;
+		}
+		node.firstChild = base;
+	}
+	vector<int>().swap(indexStore);
+	indices.set(nullptr, 0);
+	offsets.set(offsetStore);
+	return true;
+}
+
+// buildSubtree:  recursively split "node" of the node array "out" until it
+//                reaches numLevels or holds maxLeafSize points or fewer
+//
+void Octree::buildSubtree(vector<FlatNode> & out, int node, int numLevels, int level) {
+	if (level >= numLevels || out[node].numPoints <= buildParams.maxLeafSize) return;
+	splitNode(out, node);
+	int first = out[node].firstChild;
+	int count = out[node].numChildren;
+	for (int i = 0; i < count; i++) {
+		buildSubtree(out, first + i, numLevels, level + 1);
+	}
+}
+
+// splitNode:  bucket the points of "node" into its eight octants in place.  A
+//             first pass computes the octant of every point and counts them,
+//             a second pass permutes the range so each octant is contiguous
+//             (American flag sort).  The non-empty octants are appended to
+//             "out" as the node's children, in octant order.
+//
+void Octree::splitNode(vector<FlatNode> & out, int node) {
+	Box box = out[node].box;
+	Vector3 center = box.center();
+	int begin = out[node].firstPoint;
+	int end = begin + out[node].numPoints;
+
+	int count[8] = { 0 };
+	for (int i = begin; i < end; i++) {
+		const glm::vec3 & v = centers[indexStore[i]];
+		unsigned char octant = (v.x >= center.x() ? 1 : 0) | (v.y >= center.y() ? 2 : 0) | (v.z >= center.z() ? 4 : 0);
+		octants[i] = octant;
+		count[octant]++;
+	}
+
+	int start[8], next[8];
+	start[0] = begin;
+	for (int k = 1; k < 8; k++) start[k] = start[k - 1] + count[k - 1];
+	for (int k = 0; k < 8; k++) next[k] = start[k];
+	for (int k = 0; k < 8; k++) {
+		int bucketEnd = start[k] + count[k];
+		while (next[k] < bucketEnd) {
+			int i = next[k];
+			int octant = octants[i];
+			if (octant == k) {
+				next[k]++;
+			}
+			else {
+				int j = next[octant]++;
+				std::swap(indexStore[i], indexStore[j]);
+				std::swap(octants[i], octants[j]);
+			}
+		}
+	}
+
+	out[node].firstChild = out.size();
+	out[node].numChildren = 0;
+	out[node].childMask = 0;
+	for (int k = 0; k < 8; k++) {
+		if (count[k] == 0) continue;
+		FlatNode child;
+		child.box = octantBox(box, k);
+		child.firstChild = -1;
+		child.numChildren = 0;
+		child.childMask = 0;
+		child.level = out[node].level + 1;
+		child.firstPoint = start[k];
+		child.numPoints = count[k];
+		out.push_back(child);
+		out[node].numChildren++;
+		out[node].childMask |= 1 << k;
+	}
+}
+
+// Morton code helpers: spread the low bits of a quantized coordinate so
+// there are two zero bits between each of them, then interleave x, y, z.
+// 32 bit keys hold 10 bits per axis (30 bits), 64 bit keys 21 (63 bits).
+//
+static uint32_t spreadBits(uint32_t v) {
+	v &= 0x3ff;
+	v = (v | (v << 16)) & 0x030000ff;
+	v = (v | (v << 8)) & 0x0300f00f;
+	v = (v | (v << 4)) & 0x030c30c3;
+	v = (v | (v << 2)) & 0x09249249;
+	return v;
+}
+
+static uint64_t spreadBits(uint64_t v) {
+	v &= 0x1fffff;
+	v = (v | (v << 32)) & 0x001f00000000ffffull;
+	v = (v | (v << 16)) & 0x001f0000ff0000ffull;
+	v = (v | (v << 8)) & 0x100f00f00f00f00full;
+	v = (v | (v << 4)) & 0x10c30c30c30c30c3ull;
+	v = (v | (v << 2)) & 0x1249249249249249ull;
+	return v;
+}
+
+// LSD radix sort of (key, value) pairs, 8 bits per pass over the low "bits" bits
+//
+template <class Key>
+static void radixSort(vector<Key> & keys, vector<int> & values, int bits) {
+	vector<Key> keyTmp(keys.size());
+	vector<int> valueTmp(values.size());
+	for (int shift = 0; shift < bits; shift += 8) {
+		int count[257] = { 0 };
+		for (size_t i = 0; i < keys.size(); i++) {
+			count[((keys[i] >> shift) & 0xff) + 1]++;
+		}
+		for (int k = 0; k < 256; k++) count[k + 1] += count[k];
+		for (size_t i = 0; i < keys.size(); i++) {
+			int slot = count[(keys[i] >> shift) & 0xff]++;
+			keyTmp[slot] = keys[i];
+			valueTmp[slot] = values[i];
+		}
+		keys.swap(keyTmp);
+		values.swap(valueTmp);
+	}
+}
+
+// cell of the Morton builder: a run [begin, end) of the sorted index array and
+// the run of its children in the next finer level
+//
+class MortonCell {
+public:
+	int begin, end;
+	int childBegin, childCount;
+	int octant;
+};
+
+// createMorton:  build the flat layout bottom-up from Morton codes instead of
+//                repeated top-down box tests.  Uses 30 bit keys up to 10
+//                levels and 63 bit keys up to 21.
+//
+void Octree::createMorton(int numLevels) {
+	if (numLevels > 21) numLevels = 21;
+	if (numLevels <= 10) buildMorton<uint32_t>(numLevels);
+	else buildMorton<uint64_t>(numLevels);
+}
+
+//  Every primitive is quantized to a 2^numLevels grid over the mesh bounds and
+//  given a Morton code whose top three bits are its level 1 octant, the next
+//  three its level 2 octant and so on (same octant order as splitNode).  The
+//  indices are radix sorted by code, so every cell at every level is a run of
+//  equal code prefixes.  Cells are then formed bottom-up: the finest cells are
+//  the runs of equal codes, and each coarser level groups consecutive cells of
+//  the level below that share a prefix.  A cell with maxLeafSize points or
+//  fewer does not keep its children, matching the partition builder.  Finally the levels are
+//  laid out top-down, breadth first, so children stay contiguous.
+//
+template <class Key>
+void Octree::buildMorton(int numLevels) {
+	root = TreeNode();
+	root.box = meshBounds(mesh);
+	nodeStore.clear();
+
+	// quantize and encode every primitive
+	//
+	initPrimitives();
+	Vector3 bmin = root.box.min();
+	Vector3 extent = root.box.max() - bmin;
+	Key cells = Key(1) << numLevels;
+	double scale[3];
+	for (int k = 0; k < 3; k++) scale[k] = extent[k] > 0 ? cells / (double)extent[k] : 0;
+	vector<Key> code(numCenters);
+	for (int i = 0; i < numCenters; i++) {
+		Key q[3];
+		for (int k = 0; k < 3; k++) {
+			double f = (centers[i][k] - (double)bmin[k]) * scale[k];
+			q[k] = f <= 0 ? 0 : std::min((Key)f, cells - 1);
+		}
+		code[i] = spreadBits(q[0]) | (spreadBits(q[1]) << 1) | (spreadBits(q[2]) << 2);
+	}
+
+	vector<Key> keys(indexStore.size());
+	for (size_t i = 0; i < indexStore.size(); i++) {
+		keys[i] = code[indexStore[i]];
+	}
+	vector<Key>().swap(code);
+	radixSort(keys, indexStore, 3 * numLevels);
+
+	// finest level: runs of equal codes
+	//
+	vector<vector<MortonCell>> levelCells(numLevels + 1);
+	for (size_t i = 0; i < keys.size(); ) {
+		size_t j = i + 1;
+		while (j < keys.size() && keys[j] == keys[i]) j++;
+		MortonCell cell;
+		cell.begin = i;
+		cell.end = j;
+		cell.childBegin = 0;
+		cell.childCount = 0;
+		cell.octant = keys[i] & 7;
+		levelCells[numLevels].push_back(cell);
+		i = j;
+	}
+
+	// coarser levels: group cells of the level below by their code prefix and
+	// drop the children of any cell small enough to be a leaf
+	//
+	for (int level = numLevels - 1; level >= 0; level--) {
+		vector<MortonCell> & finer = levelCells[level + 1];
+		vector<MortonCell> kept;
+		int shift = 3 * (numLevels - level);
+		for (size_t a = 0; a < finer.size(); ) {
+			Key prefix = keys[finer[a].begin] >> shift;
+			size_t b = a + 1;
+			while (b < finer.size() && (keys[finer[b].begin] >> shift) == prefix) b++;
+			MortonCell cell;
+			cell.begin = finer[a].begin;
+			cell.end = finer[b - 1].end;
+			cell.childBegin = kept.size();
+			cell.childCount = 0;
+			cell.octant = prefix & 7;
+			if (cell.end - cell.begin > buildParams.maxLeafSize) {
+				cell.childCount = b - a;
+				kept.insert(kept.end(), finer.begin() + a, finer.begin() + b);
+			}
+			levelCells[level].push_back(cell);
+			a = b;
+		}
+		finer.swap(kept);
+	}
+	vector<Key>().swap(keys);
+
+	// lay the levels out top-down; boxes follow from the octant bits of each cell
+	//
+	vector<int> levelOffset(numLevels + 2, 0);
+	for (int level = 0; level <= numLevels; level++) {
+		levelOffset[level + 1] = levelOffset[level] + levelCells[level].size();
+	}
+	nodeStore.resize(levelOffset[numLevels + 1]);
+	octants.resize(nodeStore.size());
+	vector<int> nodeLevel(nodeStore.size());
+	for (int level = 0; level <= numLevels; level++) {
+		vector<MortonCell> & cellsAt = levelCells[level];
+		for (size_t i = 0; i < cellsAt.size(); i++) {
+			FlatNode & node = nodeStore[levelOffset[level] + i];
+			if (level == 0) node.box = root.box;
+			node.firstPoint = cellsAt[i].begin;
+			node.numPoints = cellsAt[i].end - cellsAt[i].begin;
+			node.numChildren = cellsAt[i].childCount;
+			node.childMask = 0;
+			node.level = level;
+			node.firstChild = node.numChildren > 0 ? levelOffset[level + 1] + cellsAt[i].childBegin : -1;
+			octants[levelOffset[level] + i] = cellsAt[i].octant;
+			nodeLevel[levelOffset[level] + i] = level;
+		}
+		vector<MortonCell>().swap(cellsAt);
+	}
+
+	// boxes come straight from the integer cell coordinates (rounded outward)
+	// rather than from repeated halving, so they agree with the quantization
+	//
+	vector<Key> cellCoord(nodeStore.size() * 3, 0);
+	for (size_t i = 0; i < nodeStore.size(); i++) {
+		FlatNode & node = nodeStore[i];
+		Key * q = &cellCoord[i * 3];
+		if (i > 0) {
+			double size = 1.0 / (Key(1) << nodeLevel[i]);
+			float lo[3], hi[3];
+			for (int k = 0; k < 3; k++) {
+				lo[k] = nextafterf(bmin[k] + extent[k] * (q[k] * size), -INFINITY);
+				hi[k] = nextafterf(bmin[k] + extent[k] * ((q[k] + 1) * size), INFINITY);
+			}
+			node.box = Box(Vector3(lo[0], lo[1], lo[2]), Vector3(hi[0], hi[1], hi[2]));
+		}
+		for (int c = 0; c < node.numChildren; c++) {
+			int child = node.firstChild + c;
+			node.childMask |= 1 << octants[child];
+			for (int k = 0; k < 3; k++) {
+				cellCoord[child * 3 + k] = q[k] * 2 + ((octants[child] >> k) & 1);
+			}
+		}
 	}
+	vector<unsigned char>().swap(octants);
+	if (primitives == TrianglePrimitives) fitTriangleBounds();
+	vector<glm::vec3>().swap(centroidStore);
+	nodes.set(nodeStore);
+	indices.set(indexStore);
+}
 
-	subdivide(mesh, root, numLevels, level);
+// octantBox:  the child box of "box" for an octant code (bit 0 = upper x,
+//             bit 1 = upper y, bit 2 = upper z)
+//
+Box Octree::octantBox(const Box & box, int octant) {
+	Vector3 min = box.min();
+	Vector3 max = box.max();
+	Vector3 center = box.center();
+	return Box(Vector3(octant & 1 ? center.x() : min.x(), octant & 2 ? center.y() : min.y(), octant & 4 ? center.z() : min.z()),
+		Vector3(octant & 1 ? max.x() : center.x(), octant & 2 ? max.y() : center.y(), octant & 4 ? max.z() : center.z()));
 }
 
 void Octree::subdivide(const ofMesh & mesh, TreeNode & node, int numLevels, int level) {
@@ -179,12 +822,44 @@ void Octree::subdivide(const ofMesh & mesh, TreeNode & node, int numLevels, int
 	}
 }
 
+// subdivideParallel:  same as subdivide(), but the child subtrees of the top
+//                     parallelLevels levels are handed to the task pool.  All
+//                     children of a node are filled in before any of their
+//                     tasks start, so the tree is identical to the serial build.
+//
+void Octree::subdivideParallel(TaskPool & pool, const ofMesh & mesh, TreeNode & node, int numLevels, int level) {
+	if (level >= numLevels) return;
+	if (level >= parallelLevels) {
+		subdivide(mesh, node, numLevels, level);
+		return;
+	}
+	vector<Box> boxList;
+	subDivideBox8(node.box, boxList);
+	level++;
+	for (int i = 0; i < boxList.size(); i++) {
+		TreeNode child;
+		int count = getMeshPointsInBox(mesh, node.points, boxList[i], child.points);
+		if (count > 0) {
+			child.box = boxList[i];
+			node.children.push_back(std::move(child));
+		}
+	}
+	for (unsigned int i = 0; i < node.children.size(); i++) {
+		TreeNode * child = &node.children[i];
+		if (child->points.size() > 1) {
+			pool.run([this, &pool, &mesh, child, numLevels, level]() {
+				subdivideParallel(pool, mesh, *child, numLevels, level);
+			});
+		}
+	}
+}
+
 //Checking collision
-bool Octree::intersect(const ofVec3f & vec, const TreeNode & node, TreeNode & nodeRtn) {
+bool Octree::intersect(const ofVec3f & vec, const TreeNode & node, const TreeNode *& nodeRtn) {
 	Box temp = node.box;
 	if(temp.inside(Vector3(vec.x, vec.y, vec.z))){
 		if (node.children.size() == 0) {
-			nodeRtn = node;
+			nodeRtn = &node;
 			return true;
 		}
 		else {
@@ -199,10 +874,10 @@ bool Octree::intersect(const ofVec3f & vec, const TreeNode & node, TreeNode & no
 }
 
 //Checking multiple points
-bool Octree::intersect(const Ray &ray, const TreeNode & node, vector<TreeNode> & nodeIntersected) {
+bool Octree::intersect(const Ray &ray, const TreeNode & node, vector<const TreeNode *> & nodeIntersected) {
 	if (node.box.intersect(ray, -1000, 1000)) {
 		if (node.children.size() == 0) {
-			nodeIntersected.push_back(node);
+			nodeIntersected.push_back(&node);
 			return true;
 
 		}
@@ -217,11 +892,11 @@ bool Octree::intersect(const Ray &ray, const TreeNode & node, vector<TreeNode> &
 }
 
 //Altitude check
-bool Octree::intersect(const Ray &ray, const TreeNode & node, TreeNode & nodeRtn) {
+bool Octree::intersect(const Ray &ray, const TreeNode & node, const TreeNode *& nodeRtn) {
 	if (node.box.intersect(ray, -1000, 1000)) {
 		// at leaf node
 		if (node.children.size() == 0) {
-			nodeRtn = node;
+			nodeRtn = &node;
 			return true;
 
 		}
@@ -236,7 +911,1456 @@ bool Octree::intersect(const Ray &ray, const TreeNode & node, TreeNode & nodeRtn
 	return false;
 }
 
+//Checking collision (flat layout)
+bool Octree::intersect(const ofVec3f & vec, int node, int & nodeRtn) {
+	const FlatNode & n = nodes[node];
+	if (n.box.inside(Vector3(vec.x, vec.y, vec.z))) {
+		if (n.numChildren == 0) {
+			nodeRtn = node;
+			return true;
+		}
+		else {
+			for (int i = 0; i < n.numChildren; i++) {
+				if (intersect(vec, n.firstChild + i, nodeRtn)) {
+					return true;
+				}
+			}
+		}
+	}
+	return false;
+}
+
+//Checking multiple points (flat layout)
+bool Octree::intersect(const Ray &ray, int node, vector<int> & nodeIntersected) {
+	const FlatNode & n = nodes[node];
+	if (n.box.intersect(ray, -1000, 1000)) {
+		if (n.numChildren == 0) {
+			nodeIntersected.push_back(node);
+			return true;
+		}
+		else {
+			for (int i = 0; i < n.numChildren; i++) {
+				intersect(ray, n.firstChild + i, nodeIntersected);
+			}
+			return nodeIntersected.size() > 0;
+		}
+	}
+	return false;
+}
+
+//Altitude check (flat layout)
+bool Octree::intersect(const Ray &ray, int node, int & nodeRtn) {
+	const FlatNode & n = nodes[node];
+	if (n.box.intersect(ray, -1000, 1000)) {
+		// at leaf node
+		if (n.numChildren == 0) {
+			nodeRtn = node;
+			return true;
+		}
+		else {
+			for (int i = 0; i < n.numChildren; i++) {
+				if (intersect(ray, n.firstChild + i, nodeRtn)) {
+					return true;
+				}
+			}
+		}
+	}
+	return false;
+}
+
+// boxes overlap, faces included
+//
+static inline bool overlaps(const Box & a, const Box & b) {
+	for (int k = 0; k < 3; k++) {
+		if (a.parameters[1][k] < b.parameters[0][k] || a.parameters[0][k] > b.parameters[1][k]) return false;
+	}
+	return true;
+}
+
+//Leaves overlapping a region (flat layout)
+bool Octree::intersect(const Box & region, int node, vector<int> & nodesRtn) {
+	const FlatNode & n = nodes[node];
+	if (!overlaps(n.box, region)) return false;
+	if (n.numChildren == 0) {
+		nodesRtn.push_back(node);
+		return true;
+	}
+	bool found = false;
+	for (int i = 0; i < n.numChildren; i++) {
+		if (intersect(region, n.firstChild + i, nodesRtn)) found = true;
+	}
+	return found;
+}
+
+NodeRef Octree::ref(int node) const {
+	const FlatNode & n = nodes[node];
+	NodeRef r;
+	r.node = node;
+	if (offsets.size()) {
+		r.offsets = offsets.data + n.firstPoint;
+		r.base = n.firstChild;
+	}
+	else r.points = indices.data + n.firstPoint;
+	r.numPoints = n.numPoints;
+	return r;
+}
+
+bool Octree::intersect(const ofVec3f & vec, NodeRef & nodeRtn) {
+	int node;
+	if (nodes.size() == 0 || !intersect(vec, 0, node)) return false;
+	nodeRtn = ref(node);
+	return true;
+}
 
+bool Octree::intersect(const Ray & ray, NodeRef & nodeRtn) {
+	int node;
+	if (nodes.size() == 0 || !intersect(ray, 0, node)) return false;
+	nodeRtn = ref(node);
+	return true;
+}
+
+// Collects every leaf the ray passes through, in tree order, without the
+// intermediate id vector of the int overload.
+//
+bool Octree::intersect(const Ray & ray, vector<NodeRef> & refs) {
+	refs.clear();
+	if (nodes.size() == 0) return false;
+	int stack[maxStack];
+	int top = 0;
+	stack[top++] = 0;
+	while (top > 0) {
+		int node = stack[--top];
+		const FlatNode & n = nodes[node];
+		if (!n.box.intersect(ray, -1000, 1000)) continue;
+		if (n.numChildren == 0) {
+			refs.push_back(ref(node));
+			continue;
+		}
+		for (int i = n.numChildren - 1; i >= 0; i--) stack[top++] = n.firstChild + i;
+	}
+	return refs.size() > 0;
+}
+
+// Vertices inside a pick cone (flat layout).  Triangle leaves offer the
+// corners of their triangles; sortPicks() drops the repeats.
+//
+int Octree::intersect(const PickCone & cone, vector<PickPoint> & points) {
+	points.clear();
+	if (!bLinear) {
+		intersect(cone, root, points);
+		sortPicks(points);
+		return points.size();
+	}
+	if (nodes.size() == 0) return 0;
+	const vector<glm::vec3> & verts = mesh.getVertices();
+	int corners = primitives == TrianglePrimitives ? 3 : 1;
+	int stack[maxStack];
+	int top = 0;
+	stack[top++] = 0;
+	while (top > 0) {
+		const FlatNode & n = nodes[stack[--top]];
+		if (!cone.intersects(n.box)) continue;
+		if (n.numChildren > 0) {
+			for (int i = n.numChildren - 1; i >= 0; i--) stack[top++] = n.firstChild + i;
+			continue;
+		}
+		for (int p = n.firstPoint; p < n.firstPoint + n.numPoints; p++) {
+			int id = point(n.firstChild, p);
+			for (int c = 0; c < corners; c++) {
+				int v = corners == 3 ? mesh.getIndex(3 * id + c) : id;
+				PickPoint pick;
+				if (!cone.contains(verts[v], pick.depth)) continue;
+				pick.point = verts[v];
+				pick.vertex = v;
+				points.push_back(pick);
+			}
+		}
+	}
+	sortPicks(points);
+	return points.size();
+}
 
+// pick cone (pointer layout, recursively); its leaves hold vertex ids
+//
+void Octree::intersect(const PickCone & cone, const TreeNode & node, vector<PickPoint> & points) {
+	if (!cone.intersects(node.box)) return;
+	for (unsigned int i = 0; i < node.children.size(); i++) {
+		intersect(cone, node.children[i], points);
+	}
+	if (node.children.size() > 0) return;
+	const vector<glm::vec3> & verts = mesh.getVertices();
+	for (int v : node.points) {
+		PickPoint pick;
+		if (!cone.contains(verts[v], pick.depth)) continue;
+		pick.point = verts[v];
+		pick.vertex = v;
+		points.push_back(pick);
+	}
+}
 
+// linkNodes:  parent and face neighbor links for the query cursor.  Nodes
+//              always follow their parent, so one forward pass sees a parent's
+//              links before its children's.  Across a face that stays inside
+//              the parent the neighbor is the sibling octant; otherwise it is
+//              the matching child of the parent's neighbor.  Where that cell
+//              was never split (or is empty) the coarser node stands in, and
+//              where a chain was collapsed the node that absorbed it does.
+//
+void Octree::linkNodes() {
+	int n = nodes.size();
+	parents.assign(n, -1);
+	neighbors.assign(n * 6, -1);
+	for (int p = 0; p < n; p++) {
+		linkChildren(p);
+	}
+}
 
+// linkChildren:  links of the children of "node", from the node's own
+//
+void Octree::linkChildren(int node) {
+	const FlatNode & n = nodes[node];
+	for (int o = 0; o < 8; o++) {
+		if (!(n.childMask & (1 << o))) continue;
+		int c = n.firstChild + childSlot(n.childMask, o);
+		parents[c] = node;
+		for (int face = 0; face < 6; face++) {
+			neighbors[c * 6 + face] = linkAcross(node, o, face);
+		}
+	}
+}
+
+// linkAcross:  neighbor across "face" of the child of "parent" in "octant"
+//
+int Octree::linkAcross(int parent, int octant, int face) const {
+	int bit = 1 << (face >> 1);
+	bool upper = (face & 1) != 0;
+	int across = (((octant & bit) != 0) == upper) ? live(neighbors[parent * 6 + face]) : parent;
+	if (across >= 0 && nodes[across].level == nodes[parent].level) {
+		const FlatNode & a = nodes[across];
+		int o = octant ^ bit;
+		if (a.childMask & (1 << o)) across = a.firstChild + childSlot(a.childMask, o);
+	}
+	return across;
+}
+
+// point containment below "node", leaving out the subtree of child "skip"
+//
+bool Octree::intersect(const ofVec3f & p, int node, int skip, int & nodeRtn, int & boxTests) {
+	const FlatNode & n = nodes[node];
+	boxTests++;
+	if (!n.box.inside(Vector3(p.x, p.y, p.z))) return false;
+	if (n.numChildren == 0) {
+		nodeRtn = node;
+		return true;
+	}
+	for (int i = 0; i < n.numChildren; i++) {
+		int child = n.firstChild + i;
+		if (child != skip && intersect(p, child, -1, nodeRtn, boxTests)) return true;
+	}
+	return false;
+}
+
+// Coherent point query.  A body that moved a little is usually still in its
+// last leaf, or in the leaf behind the face it crossed.  Otherwise climb from
+// the last leaf, searching each ancestor minus the subtree already searched;
+// node boxes nest, so an ancestor whose box misses the point is skipped in
+// one test and the climb still covers the whole tree by the time it reaches
+// the root.
+//
+bool Octree::intersect(const ofVec3f & p, QueryCursor & cursor, NodeRef & nodeRtn) {
+	cursor.boxTests = 0;
+	if (nodes.size() == 0) return false;
+	int leaf = cursor.node;
+	int node;
+	if (leaf < 0 || leaf >= (int)nodes.size() || nodes[leaf].numChildren != 0 || parents.size() != nodes.size()) {
+		if (!intersect(p, 0, -1, node, cursor.boxTests)) return false;
+		cursor.node = node;
+		nodeRtn = ref(node);
+		return true;
+	}
+
+	Vector3 v(p.x, p.y, p.z);
+	const Box & box = nodes[leaf].box;
+	cursor.boxTests++;
+	if (box.inside(v)) {
+		nodeRtn = ref(leaf);
+		return true;
+	}
+	for (int k = 0; k < 3; k++) {
+		int face = -1;
+		if (v[k] < box.parameters[0][k]) face = 2 * k;
+		else if (v[k] > box.parameters[1][k]) face = 2 * k + 1;
+		int across = face < 0 ? -1 : live(neighbors[leaf * 6 + face]);
+		if (across >= 0 && intersect(p, across, -1, node, cursor.boxTests)) {
+			cursor.node = node;
+			nodeRtn = ref(node);
+			return true;
+		}
+	}
+	cursor.boxTests++;
+	if (!nodes[0].box.inside(v)) return false;
+	for (int prev = leaf, a = parents[leaf]; a >= 0; prev = a, a = parents[a]) {
+		if (intersect(p, a, prev, node, cursor.boxTests)) {
+			cursor.node = node;
+			nodeRtn = ref(node);
+			return true;
+		}
+	}
+	return false;
+}
+
+// Nearest exact hit along a ray (flat layout), front to back.  Children are
+// visited in ray order: with the ray's sign bits as an octant mask, octants
+// in increasing order of (octant ^ mask) never occlude an earlier one.  The
+// stack keeps the entry distance of every node, so once a hit is found any
+// node entered beyond it is skipped without touching its children.  For a
+// swept sphere every box is grown by the radius.  The children of a node are
+// gathered into a Box8 and tested in one go.
+//
+bool Octree::sweep(const Ray & ray, float radius, OctreeHit & hit, float tMin, float tMax) {
+	hit.distance = tMax;
+	hit.triangle = -1;
+	hit.node = -1;
+	if (nodes.size() == 0) return false;
+
+	float entry;
+	if (intersectBox(nodes[0].box, ray, radius, tMin, hit.distance, entry)) sweep(ray, radius, 0, tMin, hit);
+	if (hit.node < 0) return false;
+
+	Vector3 o = ray.origin;
+	Vector3 d = ray.direction;
+	hit.point = ofVec3f(o.x(), o.y(), o.z()) + ofVec3f(d.x(), d.y(), d.z()) * hit.distance;
+	return true;
+}
+
+// the traversal of sweep() below "node", which the ray has entered; "hit"
+// keeps the nearest hit so far
+//
+void Octree::sweep(const Ray & ray, float radius, int node, float tMin, OctreeHit & hit) {
+	int signMask = ray.sign[0] | (ray.sign[1] << 1) | (ray.sign[2] << 2);
+	int stackNode[maxStack];
+	float stackEntry[maxStack];
+	int top = 0;
+	stackNode[top] = node;
+	stackEntry[top++] = tMin;
+	Box8 children = {};
+	float tEntry[8];
+	while (top > 0) {
+		top--;
+		if (stackEntry[top] >= hit.distance) continue;
+		const FlatNode & n = nodes[stackNode[top]];
+		if (n.numChildren == 0) {
+			intersectLeaf(ray, radius, stackNode[top], tMin, hit);
+			continue;
+		}
+
+		for (int slot = 0; slot < n.numChildren; slot++) {
+			const Box & box = nodes[n.firstChild + slot].box;
+			for (int k = 0; k < 3; k++) {
+				children.lo[k][slot] = box.parameters[0][k];
+				children.hi[k][slot] = box.parameters[1][k];
+			}
+		}
+		int hits = children.intersect(ray, radius, tMin, hit.distance, tEntry) & ((1 << n.numChildren) - 1);
+		if (!hits) continue;
+
+		// push far to near so the nearest child is popped first
+		//
+		for (int i = 7; i >= 0; i--) {
+			int octant = i ^ signMask;
+			if (!(n.childMask & (1 << octant))) continue;
+			int slot = childSlot(n.childMask, octant);
+			if (!(hits & (1 << slot))) continue;
+			stackNode[top] = n.firstChild + slot;
+			stackEntry[top++] = tEntry[slot];
+		}
+	}
+}
+
+// nearest hits of a batch, a packet of up to eight consecutive rays at a time
+//
+int Octree::intersect(const RayBatch & rays, vector<OctreeHit> & hits, float tMin, float tMax) {
+	int n = rays.size();
+	hits.resize(n);
+	for (int i = 0; i < n; i++) {
+		hits[i].distance = tMax;
+		hits[i].triangle = -1;
+		hits[i].node = -1;
+	}
+	if (nodes.size() == 0) return 0;
+
+	RayPacket packet;
+	Ray batch[RayPacket::maxRays];
+	int count = 0;
+	for (int first = 0; first < n; first += RayPacket::maxRays) {
+		int size = std::min(n - first, RayPacket::maxRays);
+		for (int i = 0; i < size; i++) batch[i] = rays.ray(first + i);
+		packet.set(batch, size);
+		intersectPacket(packet, &hits[first], tMin);
+		for (int i = 0; i < size; i++) {
+			OctreeHit & hit = hits[first + i];
+			if (hit.node < 0) continue;
+			Vector3 o = batch[i].origin;
+			Vector3 d = batch[i].direction;
+			hit.point = ofVec3f(o.x(), o.y(), o.z()) + ofVec3f(d.x(), d.y(), d.z()) * hit.distance;
+			count++;
+		}
+	}
+	return count;
+}
+
+// intersectPacket:  sweep() for a packet of rays.  Every stack entry carries
+//                   the lanes that entered the node and their entry
+//                   distances; a lane drops out of a node it enters beyond
+//                   its own nearest hit, and a node is skipped once no lane
+//                   is left.  The per lane hits start out as set by the
+//                   caller (distance = tMax).
+//
+void Octree::intersectPacket(const RayPacket & packet, OctreeHit * hits, float tMin) {
+	class PacketEntry {
+	public:
+		int node;
+		int lanes;
+		float entry[RayPacket::maxRays];
+	};
+
+	const Ray & lead = packet.rays[0];
+	int signMask = lead.sign[0] | (lead.sign[1] << 1) | (lead.sign[2] << 2);
+	float tFar[RayPacket::maxRays];
+	for (int i = 0; i < RayPacket::maxRays; i++) tFar[i] = hits[i < packet.count ? i : 0].distance;
+
+	PacketEntry stack[maxStack];
+	int top = 0;
+	stack[0].node = 0;
+	stack[0].lanes = packet.intersect(nodes[0].box, tMin, tFar, stack[0].entry);
+	if (stack[0].lanes) top++;
+	while (top > 0) {
+		const PacketEntry & e = stack[--top];
+		int lanes = e.lanes;
+		for (int i = 0; i < packet.count; i++) {
+			if (e.entry[i] >= tFar[i]) lanes &= ~(1 << i);
+		}
+		if (!lanes) continue;
+		int node = e.node;
+		const FlatNode & n = nodes[node];
+
+		// once the packet has come apart the lanes left go on alone
+		//
+		int active = 0;
+		for (int bits = lanes; bits; bits &= bits - 1) active++;
+		if (n.numChildren != 0 && active < minPacketRays) {
+			for (int i = 0; i < packet.count; i++) {
+				if (!(lanes & (1 << i))) continue;
+				sweep(packet.rays[i], 0, node, tMin, hits[i]);
+				tFar[i] = hits[i].distance;
+			}
+			continue;
+		}
+		if (n.numChildren == 0) {
+			for (int i = 0; i < packet.count; i++) {
+				if (!(lanes & (1 << i))) continue;
+				intersectLeaf(packet.rays[i], 0, node, tMin, hits[i]);
+				tFar[i] = hits[i].distance;
+			}
+			continue;
+		}
+
+		// push far to near (for the lead ray) so the nearest child is popped first
+		//
+		for (int i = 7; i >= 0; i--) {
+			int octant = i ^ signMask;
+			if (!(n.childMask & (1 << octant))) continue;
+			int child = n.firstChild + childSlot(n.childMask, octant);
+			PacketEntry & c = stack[top];
+			c.lanes = packet.intersect(nodes[child].box, tMin, tFar, c.entry) & lanes;
+			if (!c.lanes) continue;
+			c.node = child;
+			top++;
+		}
+	}
+}
+
+// test the primitives of one leaf, keeping the hit if it is closer than "hit"
+//
+void Octree::intersectLeaf(const Ray & ray, float radius, int node, float tMin, OctreeHit & hit) {
+	const FlatNode & n = nodes[node];
+	const vector<glm::vec3> & verts = mesh.getVertices();
+	glm::vec3 dir(ray.direction.x(), ray.direction.y(), ray.direction.z());
+	glm::vec3 origin(ray.origin.x(), ray.origin.y(), ray.origin.z());
+
+	for (int p = n.firstPoint; p < n.firstPoint + n.numPoints; p++) {
+		if (primitives == TrianglePrimitives) {
+			int t = point(n.firstChild, p);
+			if (radius > 0 ? sweepTriangle(mesh, ray, radius, t, tMin, hit) : hitTriangle(mesh, ray, t, tMin, hit)) {
+				hit.node = node;
+			}
+		}
+		else if (radius > 0) {
+			// vertex mode sweep: the sphere against each leaf vertex
+			//
+			int v = point(n.firstChild, p);
+			float dist;
+			if (sweepPoint(ray, radius, verts[v], tMin, dist) && dist < hit.distance) {
+				hit.distance = dist;
+				hit.triangle = -1;
+				hit.node = node;
+				hit.normal = glm::normalize(origin + dir * dist - verts[v]);
+			}
+		}
+		else {
+			// vertex mode: the leaf vertex nearest the ray origin along the ray
+			//
+			int v = point(n.firstChild, p);
+			float dist = glm::dot(verts[v] - origin, dir) / glm::dot(dir, dir);
+			if (dist > tMin && dist < hit.distance) {
+				hit.distance = dist;
+				hit.triangle = -1;
+				hit.node = node;
+				hit.normal = mesh.hasNormals() ? ofVec3f(mesh.getNormal(v)) : ofVec3f(0, 1, 0);
+			}
+		}
+	}
+}
+
+// box around "box" moved by "m": the center is transformed and each world
+// half extent sums the model half extents scaled by the matrix column sizes
+//
+static Box transformBox(const glm::mat4 & m, const Box & box) {
+	glm::vec3 lo(box.parameters[0].x(), box.parameters[0].y(), box.parameters[0].z());
+	glm::vec3 hi(box.parameters[1].x(), box.parameters[1].y(), box.parameters[1].z());
+	glm::vec3 c = glm::vec3(m * glm::vec4((lo + hi) * 0.5f, 1));
+	glm::vec3 e = (hi - lo) * 0.5f;
+	glm::vec3 r;
+	for (int i = 0; i < 3; i++) {
+		r[i] = fabs(m[0][i]) * e.x + fabs(m[1][i]) * e.y + fabs(m[2][i]) * e.z;
+	}
+	return Box(Vector3(c.x - r.x, c.y - r.y, c.z - r.z), Vector3(c.x + r.x, c.y + r.y, c.z + r.z));
+}
+
+static Box triangleBox(const glm::vec3 v[3]) {
+	glm::vec3 lo = glm::min(v[0], glm::min(v[1], v[2]));
+	glm::vec3 hi = glm::max(v[0], glm::max(v[1], v[2]));
+	return Box(Vector3(lo.x, lo.y, lo.z), Vector3(hi.x, hi.y, hi.z));
+}
+
+// signed distances of the corners of "v" from the plane of "u" (unit
+// normal "n"), snapped to 0 within "eps".  False if all are on one side.
+//
+static bool planeSides(const glm::vec3 u[3], const glm::vec3 & n, const glm::vec3 v[3], float eps, float d[3]) {
+	for (int i = 0; i < 3; i++) {
+		d[i] = glm::dot(n, v[i] - u[0]);
+		if (fabs(d[i]) < eps) d[i] = 0;
+	}
+	return !((d[0] > 0 && d[1] > 0 && d[2] > 0) || (d[0] < 0 && d[1] < 0 && d[2] < 0));
+}
+
+// interval the plane of the other triangle cuts out of triangle "p" along an
+// axis ("proj" the corners projected on it, "d" their plane distances): the
+// edges from the corner alone on its side of the plane to the other two
+//
+static void planeInterval(const float proj[3], const float d[3], float & t0, float & t1) {
+	int lone;
+	if (d[0] * d[1] > 0) lone = 2;
+	else if (d[0] * d[2] > 0) lone = 1;
+	else if (d[1] * d[2] > 0 || d[0] != 0) lone = 0;
+	else if (d[1] != 0) lone = 1;
+	else lone = 2;
+	int a = (lone + 1) % 3;
+	int b = (lone + 2) % 3;
+	t0 = proj[lone] + (proj[a] - proj[lone]) * d[lone] / (d[lone] - d[a]);
+	t1 = proj[lone] + (proj[b] - proj[lone]) * d[lone] / (d[lone] - d[b]);
+	if (t0 > t1) std::swap(t0, t1);
+}
+
+// Moller's interval test: two triangles cross if each straddles the plane
+// of the other and the segments the planes cut out of them overlap on the
+// planes' line of intersection.  Coplanar triangles only touch and count as
+// apart.
+//
+static bool trianglesCross(const glm::vec3 a[3], const glm::vec3 & na, const glm::vec3 b[3], const glm::vec3 & nb, float eps) {
+	float da[3], db[3];
+	if (!planeSides(b, nb, a, eps, da)) return false;
+	if (!planeSides(a, na, b, eps, db)) return false;
+	if (da[0] == 0 && da[1] == 0 && da[2] == 0) return false;
+
+	// project on the coordinate axis closest to the line's direction
+	//
+	glm::vec3 line = glm::abs(glm::cross(na, nb));
+	int k = line.x > line.y ? (line.x > line.z ? 0 : 2) : (line.y > line.z ? 1 : 2);
+	float pa[3] = { a[0][k], a[1][k], a[2][k] };
+	float pb[3] = { b[0][k], b[1][k], b[2][k] };
+	float a0, a1, b0, b1;
+	planeInterval(pa, da, a0, a1);
+	planeInterval(pb, db, b0, b1);
+	return a0 <= b1 && b0 <= a1;
+}
+
+// a model triangle moved into the world, with its unit normal and box
+//
+class WorldTriangle {
+public:
+	glm::vec3 v[3];
+	glm::vec3 normal;
+	Box box;
+	float size;
+	int id;
+};
+
+// Contacts of a placed model with this tree.  The pair stack starts at the
+// two roots; a pair whose boxes overlap splits the node with the larger
+// box (by its longest side), or the one that is not a leaf, and pushes the
+// children that still overlap the other box.  A pair of leaves tests the
+// terrain triangles whose boxes touch the model leaf against each model
+// triangle whose box touches theirs.  The triangles of a model leaf are
+// moved into the world the first time the leaf reaches a terrain leaf and
+// kept for the other terrain leaves it meets.
+//
+int Octree::collide(const Octree & model, const glm::mat4 & transform, vector<MeshContact> & contacts) const {
+	contacts.clear();
+	if (!nodes.size() || !model.nodes.size()) return 0;
+	if (primitives != TrianglePrimitives || model.primitives != TrianglePrimitives) return 0;
+
+	Box modelRoot = transformBox(transform, model.nodes[0].box);
+	if (!overlaps(nodes[0].box, modelRoot)) return 0;
+	Vector3 rootCenter = (modelRoot.parameters[0] + modelRoot.parameters[1]) * 0.5;
+	glm::vec3 center(rootCenter.x(), rootCenter.y(), rootCenter.z());
+
+	struct Pair {
+		int node;
+		int modelNode;
+		Box modelBox;
+	};
+	// every step can push up to 8 pairs and the walk goes down both trees,
+	// so the stack grows as it needs to
+	//
+	vector<Pair> stack;
+	stack.reserve(256);
+	stack.push_back({ 0, 0, modelRoot });
+
+	const vector<glm::vec3> & verts = mesh.getVertices();
+	const vector<glm::vec3> & modelVerts = model.mesh.getVertices();
+	vector<int> leafStart(model.nodes.size(), -1);		// first of a model leaf's triangles in "world"
+	vector<WorldTriangle> world;
+	vector<Box> leafBoxes(model.nodes.size());
+	while (!stack.empty()) {
+		Pair pair = stack.back();
+		stack.pop_back();
+		const FlatNode & n = nodes[pair.node];
+		const FlatNode & m = model.nodes[pair.modelNode];
+
+		if (n.numChildren > 0 || m.numChildren > 0) {
+			Vector3 size = n.box.parameters[1] - n.box.parameters[0];
+			Vector3 modelSize = pair.modelBox.parameters[1] - pair.modelBox.parameters[0];
+			float side = std::max(size.x(), std::max(size.y(), size.z()));
+			float modelSide = std::max(modelSize.x(), std::max(modelSize.y(), modelSize.z()));
+			if (m.numChildren == 0 || (n.numChildren > 0 && side >= modelSide)) {
+				for (int i = n.numChildren - 1; i >= 0; i--) {
+					int child = n.firstChild + i;
+					if (!overlaps(nodes[child].box, pair.modelBox)) continue;
+					stack.push_back({ child, pair.modelNode, pair.modelBox });
+				}
+			}
+			else {
+				for (int i = m.numChildren - 1; i >= 0; i--) {
+					int child = m.firstChild + i;
+					Box childBox = transformBox(transform, model.nodes[child].box);
+					if (!overlaps(n.box, childBox)) continue;
+					stack.push_back({ pair.node, child, childBox });
+				}
+			}
+			continue;
+		}
+
+		// leaf pair
+		//
+		if (leafStart[pair.modelNode] < 0) {
+			leafStart[pair.modelNode] = world.size();
+			glm::vec3 lo(FLT_MAX);
+			glm::vec3 hi(-FLT_MAX);
+			for (int q = 0; q < m.numPoints; q++) {
+				WorldTriangle w;
+				w.id = model.point(m.firstChild, m.firstPoint + q);
+				for (int i = 0; i < 3; i++) {
+					w.v[i] = glm::vec3(transform * glm::vec4(modelVerts[model.mesh.getIndex(3 * w.id + i)], 1));
+				}
+				w.box = triangleBox(w.v);
+				Vector3 size = w.box.parameters[1] - w.box.parameters[0];
+				w.size = std::max(size.x(), std::max(size.y(), size.z()));
+				glm::vec3 normal = glm::cross(w.v[1] - w.v[0], w.v[2] - w.v[0]);
+				float length = glm::length(normal);
+				w.normal = length > 0 ? normal / length : glm::vec3(0);
+				world.push_back(w);
+				for (int i = 0; i < 3; i++) {
+					lo = glm::min(lo, w.v[i]);
+					hi = glm::max(hi, w.v[i]);
+				}
+			}
+			leafBoxes[pair.modelNode] = Box(Vector3(lo.x, lo.y, lo.z), Vector3(hi.x, hi.y, hi.z));
+		}
+		const WorldTriangle * modelTriangles = &world[leafStart[pair.modelNode]];
+		const Box & leafBox = leafBoxes[pair.modelNode];
+		if (!overlaps(n.box, leafBox)) continue;
+
+		for (int p = 0; p < n.numPoints; p++) {
+			int t = point(n.firstChild, n.firstPoint + p);
+			glm::vec3 tv[3];
+			for (int i = 0; i < 3; i++) tv[i] = verts[mesh.getIndex(3 * t + i)];
+			Box tBox = triangleBox(tv);
+			if (!overlaps(tBox, leafBox)) continue;
+			glm::vec3 normal = glm::cross(tv[1] - tv[0], tv[2] - tv[0]);
+			float length = glm::length(normal);
+			if (length == 0) continue;
+			normal /= length;
+			Vector3 tSize = tBox.parameters[1] - tBox.parameters[0];
+			float size = std::max(tSize.x(), std::max(tSize.y(), tSize.z()));
+
+			for (int q = 0; q < m.numPoints; q++) {
+				const WorldTriangle & w = modelTriangles[q];
+				if (w.normal == glm::vec3(0) || !overlaps(tBox, w.box)) continue;
+				if (!trianglesCross(w.v, w.normal, tv, normal, 1e-5f * std::max(size, w.size))) continue;
+
+				// the model corner deepest behind the face, with the normal
+				// turned outward: to the side the mesh's vertex normals are
+				// on, or without them toward the model's center
+				//
+				glm::vec3 side = center - tv[0];
+				if (mesh.hasNormals()) {
+					side = mesh.getNormal(mesh.getIndex(3 * t)) + mesh.getNormal(mesh.getIndex(3 * t + 1)) + mesh.getNormal(mesh.getIndex(3 * t + 2));
+				}
+				glm::vec3 out = glm::dot(normal, side) < 0 ? -normal : normal;
+				int deepest = 0;
+				float lowest = FLT_MAX;
+				for (int i = 0; i < 3; i++) {
+					float d = glm::dot(out, w.v[i] - tv[0]);
+					if (d < lowest) {
+						lowest = d;
+						deepest = i;
+					}
+				}
+				MeshContact contact;
+				contact.point = w.v[deepest];
+				contact.normal = out;
+				contact.depth = std::max(0.0f, -lowest);
+				contact.triangle = t;
+				contact.modelTriangle = w.id;
+				contacts.push_back(contact);
+			}
+		}
+	}
+	return (int)contacts.size();
+}
+
+// number of nodes in a TreeNode tree
+//
+int Octree::numNodes(const TreeNode & node) {
+	int count = 1;
+	for (unsigned int i = 0; i < node.children.size(); i++) {
+		count += numNodes(node.children[i]);
+	}
+	return count;
+}
+
+// bytes held by a TreeNode tree (node structs plus their heap buffers)
+//
+size_t Octree::memoryUsage(const TreeNode & node) {
+	size_t bytes = node.points.capacity() * sizeof(int) + node.children.capacity() * sizeof(TreeNode);
+	for (unsigned int i = 0; i < node.children.size(); i++) {
+		bytes += memoryUsage(node.children[i]);
+	}
+	return bytes;
+}
+
+// statistics:  shape of the current tree (timing is left to create())
+//
+OctreeBuildStats Octree::statistics() const {
+	OctreeBuildStats stats;
+	stats.numNodes = numNodes();
+	stats.memory = memoryUsage();
+	stats.compact = offsets.size() > 0;
+	int numTriangles = mesh.getNumIndices() / 3;
+	if (stats.numNodes > 0) stats.bytesPerNode = stats.memory / (float)stats.numNodes;
+	if (numTriangles > 0) stats.bytesPerTriangle = stats.memory / (float)numTriangles;
+	if (!bLinear || nodes.size() == 0) return stats;
+
+	vector<int> depth(nodes.size(), 0);
+	size_t leafPoints = 0;
+	for (size_t i = 0; i < nodes.size(); i++) {
+		const FlatNode & node = nodes[i];
+		if (node.numChildren == 0) {
+			stats.numLeaves++;
+			stats.depth = std::max(stats.depth, depth[i]);
+			stats.maxLeafPoints = std::max(stats.maxLeafPoints, node.numPoints);
+			leafPoints += node.numPoints;
+		}
+		for (int c = node.firstChild; c < node.firstChild + node.numChildren; c++) {
+			depth[c] = depth[i] + 1;
+		}
+	}
+	stats.meanLeafPoints = stats.numLeaves > 0 ? leafPoints / (float)stats.numLeaves : 0;
+	return stats;
+}
+
+int Octree::numNodes() const {
+	if (bLinear) return nodes.size() - deadNodes;
+	return numNodes(root);
+}
+
+size_t Octree::memoryUsage() const {
+	if (bLinear) return (nodes.size() * sizeof(FlatNode) + offsets.size() * sizeof(uint16_t) +
+		(indices.size() + parents.size() + neighbors.size()) * sizeof(int) + cells.size() * sizeof(Box) +
+		(leafOf.size() + vertexTriangleStart.size() + vertexTriangles.size() + sameVertex.size()) * sizeof(int) +
+		(cells.size() ? octants.size() + centroidStore.size() * sizeof(glm::vec3) : 0));
+	return sizeof(TreeNode) + memoryUsage(root);
+}
+
+// cache file layout: this header, then the node array and the index array
+// (32 bit ids, or 16 bit offsets for a compact tree), each starting on a 64
+// byte boundary
+//
+static const char cacheMagic[8] = { 'O', 'C', 'T', 'R', 'E', 'E', 0, 0 };
+static const uint32_t cacheVersion = 3;
+
+class OctreeCacheHeader {
+public:
+	char magic[8];
+	uint32_t version;
+	uint32_t nodeSize;
+	uint32_t indexSize;
+	uint32_t reserved;
+	uint64_t key;
+	uint64_t numNodes;
+	uint64_t numIndices;
+	uint64_t nodeOffset;
+	uint64_t indexOffset;
+};
+
+static uint64_t alignOffset(uint64_t offset) {
+	return (offset + 63) & ~(uint64_t)63;
+}
+
+// 64 bit FNV-1a
+//
+static uint64_t hashBytes(uint64_t hash, const void * data, size_t length) {
+	const unsigned char * bytes = (const unsigned char *)data;
+	for (size_t i = 0; i < length; i++) {
+		hash ^= bytes[i];
+		hash *= 0x100000001b3ull;
+	}
+	return hash;
+}
+
+// cacheKey:  hash of everything the flat tree depends on: the mesh vertices
+//            and indices, the build policy, the builder, the primitive
+//            type and the format
+//
+uint64_t Octree::cacheKey(const ofMesh & mesh, const OctreeBuildParams & params, OctreeBuildType type) const {
+	uint64_t hash = 0xcbf29ce484222325ull;
+	uint32_t build[8] = { cacheVersion, (uint32_t)sizeof(FlatNode), (uint32_t)params.maxLevels, (uint32_t)params.maxLeafSize,
+		(uint32_t)type, (uint32_t)primitives, (uint32_t)params.collapseChains, (uint32_t)params.compactIndices };
+	uint64_t limits[2] = { (uint64_t)params.memoryBudget, 0 };
+	memcpy(&limits[1], &params.minCellSize, sizeof(float));
+	hash = hashBytes(hash, build, sizeof(build));
+	hash = hashBytes(hash, limits, sizeof(limits));
+	const vector<glm::vec3> & verts = mesh.getVertices();
+	const vector<ofIndexType> & meshIndices = mesh.getIndices();
+	uint64_t counts[2] = { verts.size(), meshIndices.size() };
+	hash = hashBytes(hash, counts, sizeof(counts));
+	hash = hashBytes(hash, verts.data(), verts.size() * sizeof(glm::vec3));
+	hash = hashBytes(hash, meshIndices.data(), meshIndices.size() * sizeof(ofIndexType));
+	return hash;
+}
+
+// save:  write the flat layout to "path".  The file is written next to the
+//        target and renamed over it, so a reader never maps a partial file.
+//
+bool Octree::save(const string & path, uint64_t key) const {
+	if (!bLinear || nodes.size() == 0) return false;
+
+	OctreeCacheHeader header;
+	memcpy(header.magic, cacheMagic, sizeof(cacheMagic));
+	header.version = cacheVersion;
+	header.nodeSize = sizeof(FlatNode);
+	header.indexSize = offsets.size() ? sizeof(uint16_t) : sizeof(int);
+	header.reserved = 0;
+	header.key = key;
+	header.numNodes = nodes.size();
+	header.numIndices = offsets.size() ? offsets.size() : indices.size();
+	header.nodeOffset = alignOffset(sizeof(OctreeCacheHeader));
+	header.indexOffset = alignOffset(header.nodeOffset + header.numNodes * sizeof(FlatNode));
+
+	string tmpPath = path + ".tmp";
+	{
+		std::ofstream file(tmpPath.c_str(), std::ios::binary | std::ios::trunc);
+		if (!file) return false;
+		char padding[64] = { 0 };
+		file.write((const char *)&header, sizeof(header));
+		file.write(padding, header.nodeOffset - sizeof(header));
+		file.write((const char *)nodes.data, header.numNodes * sizeof(FlatNode));
+		file.write(padding, header.indexOffset - (header.nodeOffset + header.numNodes * sizeof(FlatNode)));
+		file.write(offsets.size() ? (const char *)offsets.data : (const char *)indices.data, header.numIndices * header.indexSize);
+		if (!file) return false;
+	}
+	std::remove(path.c_str());
+	return std::rename(tmpPath.c_str(), path.c_str()) == 0;
+}
+
+// map a whole file copy-on-write; returns nullptr on failure
+//
+static void * mapFile(const string & path, size_t & length, void *& handle) {
+	handle = nullptr;
+#ifdef TARGET_WIN32
+	HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file == INVALID_HANDLE_VALUE) return nullptr;
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(file, &size) || size.QuadPart == 0) {
+		CloseHandle(file);
+		return nullptr;
+	}
+	HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_WRITECOPY, 0, 0, NULL);
+	CloseHandle(file);
+	if (mapping == NULL) return nullptr;
+	void * address = MapViewOfFile(mapping, FILE_MAP_COPY, 0, 0, 0);
+	if (address == NULL) {
+		CloseHandle(mapping);
+		return nullptr;
+	}
+	length = size.QuadPart;
+	handle = mapping;
+	return address;
+#else
+	int fd = open(path.c_str(), O_RDONLY);
+	if (fd < 0) return nullptr;
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size == 0) {
+		close(fd);
+		return nullptr;
+	}
+	void * address = mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (address == MAP_FAILED) return nullptr;
+	length = st.st_size;
+	return address;
+#endif
+}
+
+static void unmapFile(void * address, size_t length, void * handle) {
+#ifdef TARGET_WIN32
+	(void)length;
+	UnmapViewOfFile(address);
+	CloseHandle((HANDLE)handle);
+#else
+	(void)handle;
+	munmap(address, length);
+#endif
+}
+
+// load:  map the cache file at "path" and point the flat layout straight at
+//        it.  Fails (leaving the tree empty) if the file is missing, from
+//        another version or built for a different key.
+//
+bool Octree::load(const string & path, uint64_t key) {
+	release();
+
+	size_t length = 0;
+	void * handle = nullptr;
+	void * address = mapFile(path, length, handle);
+	if (address == nullptr) return false;
+
+	const OctreeCacheHeader & header = *(const OctreeCacheHeader *)address;
+	bool valid = length >= sizeof(OctreeCacheHeader) &&
+		memcmp(header.magic, cacheMagic, sizeof(cacheMagic)) == 0 &&
+		header.version == cacheVersion &&
+		header.nodeSize == sizeof(FlatNode) &&
+		(header.indexSize == sizeof(int) || header.indexSize == sizeof(uint16_t)) &&
+		header.key == key &&
+		header.numNodes > 0 &&
+		header.nodeOffset + header.numNodes * sizeof(FlatNode) <= length &&
+		header.indexOffset + header.numIndices * header.indexSize <= length;
+	if (!valid) {
+		unmapFile(address, length, handle);
+		return false;
+	}
+
+	mapAddress = address;
+	mapLength = length;
+	mapHandle = handle;
+	nodes.set((FlatNode *)((char *)address + header.nodeOffset), header.numNodes);
+	if (header.indexSize == sizeof(uint16_t)) offsets.set((uint16_t *)((char *)address + header.indexOffset), header.numIndices);
+	else indices.set((int *)((char *)address + header.indexOffset), header.numIndices);
+
+	root = TreeNode();
+	root.box = nodes[0].box;
+	linkNodes();
+	return true;
+}
+
+// release:  drop the flat layout, unmapping the cache file if one is mapped
+//
+void Octree::release() {
+	if (mapAddress != nullptr) {
+		unmapFile(mapAddress, mapLength, mapHandle);
+		mapAddress = nullptr;
+		mapLength = 0;
+		mapHandle = nullptr;
+	}
+	vector<FlatNode>().swap(nodeStore);
+	vector<int>().swap(indexStore);
+	vector<uint16_t>().swap(offsetStore);
+	nodes.set(nullptr, 0);
+	indices.set(nullptr, 0);
+	offsets.set(nullptr, 0);
+	vector<int>().swap(parents);
+	vector<int>().swap(neighbors);
+	vector<Box>().swap(cells);
+	vector<int>().swap(leafOf);
+	vector<int>().swap(vertexTriangleStart);
+	vector<int>().swap(vertexTriangles);
+	vector<int>().swap(sameVertex);
+	vector<unsigned char>().swap(octants);
+	vector<glm::vec3>().swap(centroidStore);
+	deadNodes = 0;
+	revision++;
+}
+
+bool Octree::createCached(const ofMesh & geo, const OctreeBuildParams & params, const string & path, OctreeBuildType type) {
+	if (!bLinear) {
+		create(geo, params, type);
+		return false;
+	}
+	uint64_t key = cacheKey(geo, params, type);
+	if (load(path, key)) {
+		mesh = geo;
+		buildParams = params;
+		return true;
+	}
+	create(geo, params, type);
+	if (!save(path, key)) printf("Octree cache could not be written to %s\n", path.c_str());
+	return false;
+}
+
+// centroid of triangle t
+//
+static inline glm::vec3 triangleCentroid(const ofMesh & mesh, int t) {
+	const vector<glm::vec3> & verts = mesh.getVertices();
+	return (verts[mesh.getIndex(t * 3)] + verts[mesh.getIndex(t * 3 + 1)] + verts[mesh.getIndex(t * 3 + 2)]) / 3.0f;
+}
+
+// descend from "cell" at level "from" to the cell at level "to" that holds
+// "p", choosing octants the way splitNode buckets points
+//
+static Box descendCell(Box cell, int from, int to, const glm::vec3 & p) {
+	for (int level = from; level < to; level++) {
+		Vector3 center = cell.center();
+		int octant = (p.x >= center.x() ? 1 : 0) | (p.y >= center.y() ? 2 : 0) | (p.z >= center.z() ? 4 : 0);
+		cell = Octree::octantBox(cell, octant);
+	}
+	return cell;
+}
+
+// prepareUpdates:  set up what update() keeps between calls.  A tree mapped
+//                  from the cache or stored compact is copied into owned 32
+//                  bit stores first, since updates rewrite its runs.  The
+//                  cells of a triangle tree are found again from the mesh
+//                  bounds, going down to each node's level past the
+//                  centroid of its first triangle.
+//
+void Octree::prepareUpdates() {
+	int n = nodes.size();
+	if (mapAddress != nullptr || offsets.size() > 0) {
+		vector<FlatNode> flat(nodes.data, nodes.data + n);
+		vector<int> ids(offsets.size() ? offsets.size() : indices.size());
+		for (int i = 0; i < n; i++) {
+			FlatNode & node = flat[i];
+			if (node.numChildren > 0) continue;
+			for (int p = node.firstPoint; p < node.firstPoint + node.numPoints; p++) {
+				ids[p] = point(node.firstChild, p);
+			}
+			node.firstChild = -1;
+		}
+		if (mapAddress != nullptr) {
+			unmapFile(mapAddress, mapLength, mapHandle);
+			mapAddress = nullptr;
+			mapLength = 0;
+			mapHandle = nullptr;
+		}
+		nodeStore.swap(flat);
+		indexStore.swap(ids);
+		vector<uint16_t>().swap(offsetStore);
+		nodes.set(nodeStore);
+		indices.set(indexStore);
+		offsets.set(nullptr, 0);
+	}
+
+	const vector<glm::vec3> & verts = mesh.getVertices();
+	Box bounds = meshBounds(mesh);
+	updateLevels = levelLimit(bounds);
+	if (primitives == TrianglePrimitives) {
+		int numTriangles = mesh.getNumIndices() / 3;
+		centroidStore.resize(numTriangles);
+		for (int t = 0; t < numTriangles; t++) {
+			centroidStore[t] = triangleCentroid(mesh, t);
+		}
+		centers = centroidStore.data();
+		numCenters = numTriangles;
+
+		cells.resize(n);
+		cells[0] = nodes[0].numPoints > 0 ? descendCell(bounds, 0, nodes[0].level, centers[indices[nodes[0].firstPoint]]) : bounds;
+		for (int p = 0; p < n; p++) {
+			const FlatNode & node = nodes[p];
+			for (int c = node.firstChild; c < node.firstChild + node.numChildren; c++) {
+				cells[c] = descendCell(cells[p], node.level, nodes[c].level, centers[indices[nodes[c].firstPoint]]);
+			}
+		}
+	}
+	else {
+		centers = verts.data();
+		numCenters = verts.size();
+
+		// vertex trees never grow their boxes past their cells
+		//
+		cells.resize(n);
+		for (int i = 0; i < n; i++) {
+			cells[i] = nodes[i].box;
+		}
+	}
+	octants.resize(indices.size());
+	assignLeaves();
+	linkVertices();
+	deadNodes = 0;
+}
+
+// linkVertices:  the triangles around every vertex, by a counting sort of
+//                the triangle corners, and the rings of vertices at the
+//                same position, found by sorting the ids by position
+//
+void Octree::linkVertices() {
+	const vector<glm::vec3> & verts = mesh.getVertices();
+	int numTriangles = mesh.getNumIndices() / 3;
+	vertexTriangleStart.assign(verts.size() + 1, 0);
+	for (int i = 0; i < numTriangles * 3; i++) {
+		vertexTriangleStart[mesh.getIndex(i) + 1]++;
+	}
+	for (size_t v = 0; v < verts.size(); v++) {
+		vertexTriangleStart[v + 1] += vertexTriangleStart[v];
+	}
+	vector<int> next(vertexTriangleStart.begin(), vertexTriangleStart.end() - 1);
+	vertexTriangles.resize(numTriangles * 3);
+	for (int i = 0; i < numTriangles * 3; i++) {
+		vertexTriangles[next[mesh.getIndex(i)]++] = i / 3;
+	}
+
+	vector<int> ids(verts.size());
+	for (size_t v = 0; v < verts.size(); v++) ids[v] = v;
+	std::sort(ids.begin(), ids.end(), [&](int a, int b) {
+		const glm::vec3 & u = verts[a];
+		const glm::vec3 & w = verts[b];
+		if (u.x != w.x) return u.x < w.x;
+		if (u.y != w.y) return u.y < w.y;
+		if (u.z != w.z) return u.z < w.z;
+		return a < b;
+	});
+	sameVertex.resize(verts.size());
+	for (size_t i = 0; i < ids.size(); ) {
+		size_t j = i + 1;
+		while (j < ids.size() && verts[ids[j]] == verts[ids[i]]) j++;
+		for (size_t k = i; k < j; k++) sameVertex[ids[k]] = ids[k + 1 < j ? k + 1 : i];
+		i = j;
+	}
+}
+
+// moveVertices:  move every vertex and the others at its old position, and
+//                list all of them in "moved"
+//
+void Octree::moveVertices(const vector<int> & vertices, const vector<glm::vec3> & positions, vector<int> & moved) {
+	if (sameVertex.size() != mesh.getNumVertices()) linkVertices();
+	vector<glm::vec3> & verts = mesh.getVertices();
+	int count = (int)std::min(vertices.size(), positions.size());
+	moved.clear();
+	for (int i = 0; i < count; i++) {
+		int v = vertices[i];
+		do {
+			verts[v] = positions[i];
+			moved.push_back(v);
+			v = sameVertex[v];
+		} while (v != vertices[i]);
+	}
+	std::sort(moved.begin(), moved.end());
+	moved.erase(std::unique(moved.begin(), moved.end()), moved.end());
+}
+
+// updateNormals:  normals of the vertices of every triangle around a moved
+//                 vertex, the area weighted sum of the face normals around
+//                 all the copies of the vertex.  They keep the side of the
+//                 old normal, whichever way the mesh winds.
+//
+void Octree::updateNormals(const vector<int> & moved) {
+	const vector<glm::vec3> & verts = mesh.getVertices();
+	if (mesh.getNumNormals() != verts.size() || mesh.getNumIndices() == 0) return;
+	vector<int> touched;
+	for (int v : moved) {
+		for (int i = vertexTriangleStart[v]; i < vertexTriangleStart[v + 1]; i++) {
+			int t = vertexTriangles[i];
+			for (int k = 0; k < 3; k++) touched.push_back(mesh.getIndex(3 * t + k));
+		}
+	}
+	std::sort(touched.begin(), touched.end());
+	touched.erase(std::unique(touched.begin(), touched.end()), touched.end());
+
+	vector<glm::vec3> & normals = mesh.getNormals();
+	for (int v : touched) {
+		glm::vec3 sum(0);
+		int c = v;
+		do {
+			for (int i = vertexTriangleStart[c]; i < vertexTriangleStart[c + 1]; i++) {
+				int t = vertexTriangles[i];
+				const glm::vec3 & v0 = verts[mesh.getIndex(3 * t)];
+				sum += glm::cross(verts[mesh.getIndex(3 * t + 1)] - v0, verts[mesh.getIndex(3 * t + 2)] - v0);
+			}
+			c = sameVertex[c];
+		} while (c != v);
+		if (glm::length(sum) == 0) continue;
+		sum = glm::normalize(sum);
+		normals[v] = glm::dot(sum, normals[v]) < 0 ? -sum : sum;
+	}
+}
+
+// assignLeaves:  point every primitive at the leaf holding it
+//
+void Octree::assignLeaves() {
+	leafOf.assign(numCenters, -1);
+	for (size_t i = 0; i < nodes.size(); i++) {
+		const FlatNode & node = nodes[i];
+		if (node.numChildren != 0) continue;
+		for (int p = node.firstPoint; p < node.firstPoint + node.numPoints; p++) {
+			leafOf[indices[p]] = i;
+		}
+	}
+}
+
+// Move "vertices" to "positions" and repair the tree.  Every primitive the
+// moved vertices belong to either still has its centroid (its position, for
+// a vertex) inside its leaf's cell, and the leaf is refit, or has left it:
+// then the lowest ancestor whose cell holds it is rebuilt, and since that
+// cell held the primitive's leaf too the subtree's run keeps its entries and
+// its place in the index array.  A primitive that left the root cell, or
+// whose ancestor holds more than rebuildLimit primitives (or four times the
+// moved ones), stays in its leaf, whose box grows to hold it: terrain pushed
+// across one of the top splitting planes would otherwise rebuild half the
+// tree.  Finally the dirty nodes are refit and the refit climbs their
+// ancestors until a box comes out unchanged.
+//
+OctreeUpdateStats Octree::update(const vector<int> & vertices, const vector<glm::vec3> & positions) {
+	OctreeUpdateStats stats;
+	uint64_t start = ofGetElapsedTimeMicros();
+	vector<int> movedVertices;
+	if (!bLinear || nodes.size() == 0) {
+		moveVertices(vertices, positions, movedVertices);
+		updateNormals(movedVertices);
+		stats.moved = movedVertices.size();
+		ofMesh geo = mesh;
+		create(geo, buildParams);
+		stats.rebuilt = 1;
+		stats.updateMs = (ofGetElapsedTimeMicros() - start) / 1000.0;
+		return stats;
+	}
+	if (cells.size() != nodes.size()) prepareUpdates();
+	moveVertices(vertices, positions, movedVertices);
+	updateNormals(movedVertices);
+	stats.moved = movedVertices.size();
+
+	vector<int> moved;
+	for (int v : movedVertices) {
+		if (primitives == TrianglePrimitives) {
+			moved.insert(moved.end(), vertexTriangles.begin() + vertexTriangleStart[v], vertexTriangles.begin() + vertexTriangleStart[v + 1]);
+		}
+		else if (leafOf[v] >= 0) moved.push_back(v);
+	}
+	std::sort(moved.begin(), moved.end());
+	moved.erase(std::unique(moved.begin(), moved.end()), moved.end());
+	if (primitives == TrianglePrimitives) {
+		for (int t : moved) centroidStore[t] = triangleCentroid(mesh, t);
+	}
+	stats.primitives = moved.size();
+
+	vector<int> dirty;
+	vector<int> rebuild;
+	int maxRebuild = std::max(rebuildLimit, 4 * (int)moved.size());
+	for (int p : moved) {
+		int leaf = leafOf[p];
+		Vector3 c(centers[p].x, centers[p].y, centers[p].z);
+		if (cells[leaf].inside(c)) {
+			dirty.push_back(leaf);
+			continue;
+		}
+		int a = parents[leaf];
+		while (a >= 0 && !cells[a].inside(c)) a = parents[a];
+		if (a >= 0 && nodes[a].numPoints <= maxRebuild) rebuild.push_back(a);
+		else dirty.push_back(leaf);
+	}
+	std::sort(rebuild.begin(), rebuild.end());
+	rebuild.erase(std::unique(rebuild.begin(), rebuild.end()), rebuild.end());
+
+	// only the outermost of nested subtrees is rebuilt (rebuilding unlinks
+	// the old descendants, so find them all first)
+	//
+	vector<int> outermost;
+	for (int a : rebuild) {
+		bool nested = false;
+		for (int b = parents[a]; b >= 0 && !nested; b = parents[b]) {
+			nested = std::binary_search(rebuild.begin(), rebuild.end(), b);
+		}
+		if (!nested) outermost.push_back(a);
+	}
+	for (int a : outermost) {
+		stats.rebuilt++;
+		stats.rebucketed += nodes[a].numPoints;
+		rebuildSubtree(a);
+		dirty.push_back(a);
+	}
+
+	std::sort(dirty.begin(), dirty.end());
+	dirty.erase(std::unique(dirty.begin(), dirty.end()), dirty.end());
+	for (int node : dirty) {
+		if (nodes[node].numChildren < 0) continue;		// inside a rebuilt subtree
+		refit(node);
+		stats.refit++;
+		for (int a = parents[node]; a >= 0; a = parents[a]) {
+			stats.refit++;
+			if (!refit(a)) break;
+		}
+	}
+
+	if (deadNodes * 2 > (int)nodes.size()) {
+		compactDeadNodes();
+		stats.compacted = true;
+	}
+	revision++;
+	stats.updateMs = (ofGetElapsedTimeMicros() - start) / 1000.0;
+	return stats;
+}
+
+// rebuildSubtree:  rebucket the run of "node" into a new subtree.  The node
+//                  keeps its index and its links; the new nodes are appended
+//                  and linked from it.  The old descendants are marked dead
+//                  and forward to the node, so links into them from the
+//                  nodes around it still lead to a cell that holds theirs.
+//
+void Octree::rebuildSubtree(int node) {
+	vector<int> stack;
+	for (int c = nodes[node].firstChild; c < nodes[node].firstChild + nodes[node].numChildren; c++) {
+		stack.push_back(c);
+	}
+	while (stack.size() > 0) {
+		int d = stack.back();
+		stack.pop_back();
+		FlatNode & dead = nodeStore[d];
+		for (int c = dead.firstChild; c < dead.firstChild + dead.numChildren; c++) {
+			stack.push_back(c);
+		}
+		dead.firstChild = node;
+		dead.numChildren = -1;
+		parents[d] = -1;
+		deadNodes++;
+	}
+
+	vector<FlatNode> subtree(1, nodeStore[node]);
+	subtree[0].box = cells[node];
+	subtree[0].firstChild = -1;
+	subtree[0].numChildren = 0;
+	subtree[0].childMask = 0;
+	buildSubtree(subtree, 0, updateLevels, subtree[0].level);
+	if (buildParams.collapseChains) collapseChains(subtree);
+
+	// splice it in the way createFlat does; the boxes are still the cells
+	//
+	int offset = nodeStore.size() - 1;
+	for (size_t k = 0; k < subtree.size(); k++) {
+		if (subtree[k].numChildren > 0) subtree[k].firstChild += offset;
+	}
+	nodeStore[node] = subtree[0];
+	nodeStore.insert(nodeStore.end(), subtree.begin() + 1, subtree.end());
+	nodes.set(nodeStore);
+	int n = nodeStore.size();
+	cells[node] = subtree[0].box;
+	cells.resize(n);
+	for (int i = offset + 1; i < n; i++) {
+		cells[i] = nodeStore[i].box;
+	}
+	parents.resize(n, -1);
+	neighbors.resize(n * 6, -1);
+	linkChildren(node);
+	for (int i = offset + 1; i < n; i++) {
+		linkChildren(i);
+	}
+
+	for (int i = n - 1; i > offset; i--) {
+		refit(i);
+		const FlatNode & leaf = nodeStore[i];
+		if (leaf.numChildren != 0) continue;
+		for (int p = leaf.firstPoint; p < leaf.firstPoint + leaf.numPoints; p++) {
+			leafOf[indexStore[p]] = i;
+		}
+	}
+	if (nodeStore[node].numChildren == 0) {
+		for (int p = nodeStore[node].firstPoint; p < nodeStore[node].firstPoint + nodeStore[node].numPoints; p++) {
+			leafOf[indexStore[p]] = node;
+		}
+	}
+	refit(node);
+}
+
+// refit:  the box of "node" from scratch: its cell, grown to hold its
+//         primitives (a leaf) or its children's boxes.  Returns true if the
+//         box changed.
+//
+bool Octree::refit(int node) {
+	FlatNode & n = nodeStore[node];
+	const vector<glm::vec3> & verts = mesh.getVertices();
+	float bmin[3], bmax[3];
+	for (int k = 0; k < 3; k++) {
+		bmin[k] = cells[node].parameters[0][k];
+		bmax[k] = cells[node].parameters[1][k];
+	}
+	if (n.numChildren == 0) {
+		int corners = primitives == TrianglePrimitives ? 3 : 1;
+		for (int p = n.firstPoint; p < n.firstPoint + n.numPoints; p++) {
+			for (int corner = 0; corner < corners; corner++) {
+				const glm::vec3 & v = verts[corners == 3 ? mesh.getIndex(indexStore[p] * 3 + corner) : indexStore[p]];
+				for (int k = 0; k < 3; k++) {
+					bmin[k] = std::min(bmin[k], v[k]);
+					bmax[k] = std::max(bmax[k], v[k]);
+				}
+			}
+		}
+	}
+	for (int c = n.firstChild; c < n.firstChild + n.numChildren; c++) {
+		const Box & child = nodeStore[c].box;
+		for (int k = 0; k < 3; k++) {
+			bmin[k] = std::min(bmin[k], child.parameters[0][k]);
+			bmax[k] = std::max(bmax[k], child.parameters[1][k]);
+		}
+	}
+	bool changed = false;
+	for (int k = 0; k < 3; k++) {
+		if (bmin[k] != n.box.parameters[0][k] || bmax[k] != n.box.parameters[1][k]) changed = true;
+	}
+	if (changed) n.box = Box(Vector3(bmin[0], bmin[1], bmin[2]), Vector3(bmax[0], bmax[1], bmax[2]));
+	return changed;
+}
+
+// compactDeadNodes:  drop the nodes rebuilt subtrees left behind and redo
+//                    the links and leaf map for the new numbering
+//
+void Octree::compactDeadNodes() {
+	vector<char> keep(nodes.size());
+	vector<Box> liveCells;
+	for (size_t i = 0; i < nodes.size(); i++) {
+		keep[i] = nodes[i].numChildren >= 0;
+		if (keep[i]) liveCells.push_back(cells[i]);
+	}
+	compactNodes(keep);
+	cells.swap(liveCells);
+	deadNodes = 0;
+	linkNodes();
+	assignLeaves();
+}
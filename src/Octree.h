@@ -1,7 +1,12 @@
 #pragma once
 #include "ofMain.h"
+#include <cfloat>
 #include "box.h"
 #include "ray.h"
+#include "TaskPool.h"
+#include "SpatialIndex.h"
+#include "RayPacket.h"
+#include "BoxLines.h"
 
 
 class TreeNode {
@@ -11,26 +16,373 @@ public:
 	vector<TreeNode> children;
 };
 
-class Octree {
+//  Node of the linearized (flat) octree layout.  The children of a node are
+//  stored next to each other in Octree::nodes starting at firstChild, and the
+//  points of a node are a run of Octree::indices starting at firstPoint, so
+//  the whole tree lives in two contiguous arrays.  A node's run is the
+//  concatenation of its children's runs.  Bit k of childMask is set when
+//  the child for octant k (bit 0 = upper x, 1 = upper y, 2 = upper z) exists;
+//  children are stored in octant order.  level is the depth of the node's
+//  cell, which can be deeper than its depth in the tree once single child
+//  chains are collapsed.  Leaves of a compact tree keep the base of their
+//  16 bit offsets in firstChild.
+//
+class FlatNode {
 public:
+	Box box;
+	int firstChild;
+	int numChildren;
+	int firstPoint;
+	int numPoints;
+	unsigned char childMask;
+	unsigned char level;
+};
+
+//  View of an array that lives either in a vector owned by the octree or in
+//  a memory mapped cache file.
+//
+template <class T>
+class ArrayView {
+public:
+	T & operator[](size_t i) const { return data[i]; }
+	size_t size() const { return count; }
+	void set(T * d, size_t n) { data = d; count = n; }
+	void set(vector<T> & v) { data = v.data(); count = v.size(); }
+
+	T * data = nullptr;
+	size_t count = 0;
+};
 
-	void create(const ofMesh & mesh, int numLevels);
+//  Construction path for the flat layout: top-down in-place partitioning, or
+//  bottom-up from radix sorted Morton (Z-order) codes.
+//
+typedef enum { PartitionBuild, MortonBuild } OctreeBuildType;
+
+//  What the leaves of the flat layout reference: mesh vertex indices, or
+//  triangles (index run 3 * t .. 3 * t + 2 of the mesh).  Triangle trees grow
+//  their node boxes to hold every triangle under them and answer ray queries
+//  with exact hits.
+//
+typedef enum { VertexPrimitives, TrianglePrimitives } OctreePrimitiveType;
+
+//  Subdivision policy.  A node is split while it holds more than maxLeafSize
+//  primitives, its children would be at least minCellSize on their longest
+//  side and it is above maxLevels (at most Octree::maxDepth).  With a
+//  memoryBudget (bytes for nodes, cursor links and indices, 0 = none) every
+//  node gets a share of the budget in proportion to its primitive count; a
+//  node whose share cannot pay for its children stays a leaf.  Only maxLevels
+//  applies to the pointer layout.
+//
+//  collapseChains merges every node that has a single child with that child,
+//  so sparse regions do not cost one node per level.  compactIndices stores
+//  the leaf runs as 16 bit offsets from a per leaf base; it is skipped (and
+//  the tree keeps 32 bit indices) if some leaf spans more than 65536 ids.
+//
+class OctreeBuildParams {
+public:
+	int maxLevels = 8;
+	int maxLeafSize = 1;
+	float minCellSize = 0;
+	size_t memoryBudget = 0;
+	bool collapseChains = true;
+	bool compactIndices = false;
+};
+
+//  What create() built.  numLevels is the depth limit left after minCellSize;
+//  budgetCuts counts the subtrees dropped to stay inside the memory budget
+//  and collapsed the nodes merged into their only child.  Byte counts cover
+//  the whole index (nodes, leaf runs and cursor links) but not the mesh.
+//
+class OctreeBuildStats {
+public:
+	float buildMs = 0;
+	int numLevels = 0;
+	int numNodes = 0;
+	int numLeaves = 0;
+	int depth = 0;
+	int maxLeafPoints = 0;
+	float meanLeafPoints = 0;
+	int budgetCuts = 0;
+	int collapsed = 0;
+	bool compact = false;
+	size_t memory = 0;
+	float bytesPerNode = 0;
+	float bytesPerTriangle = 0;
+};
+
+//  What update() did.  primitives counts the vertices or triangles the moved
+//  vertices belong to, refit the node boxes recomputed, rebuilt the subtrees
+//  rebucketed because a primitive left its cell and rebucketed the
+//  primitives in them.  compacted is set when the update also squeezed the
+//  dead nodes out of nodeStore.
+//
+class OctreeUpdateStats {
+public:
+	float updateMs = 0;
+	int moved = 0;
+	int primitives = 0;
+	int refit = 0;
+	int rebuilt = 0;
+	int rebucketed = 0;
+	bool compacted = false;
+};
+
+//  One contact between a placed model mesh and the terrain: a model
+//  triangle crossing a terrain triangle.  normal is the terrain face normal
+//  turned outward (the side of the terrain's vertex normals, or toward the
+//  model's center if it has none), point the model triangle's corner
+//  deepest behind the face and depth how far behind it is.
+//
+class MeshContact {
+public:
+	ofVec3f point;
+	ofVec3f normal;
+	float depth = 0;
+	int triangle = -1;			// terrain triangle
+	int modelTriangle = -1;
+};
+
+class Octree : public SpatialIndex {
+public:
+	Octree() {}
+	~Octree() { release(); }
+	Octree(const Octree &) = delete;
+	Octree & operator=(const Octree &) = delete;
+
+	OctreeBuildStats create(const ofMesh & mesh, const OctreeBuildParams & params, OctreeBuildType type = PartitionBuild);
+	OctreeBuildStats create(const ofMesh & mesh, int numLevels, OctreeBuildType type = PartitionBuild) {
+		OctreeBuildParams params;
+		params.maxLevels = numLevels;
+		return create(mesh, params, type);
+	}
+	OctreeBuildStats statistics() const;
 	void subdivide(const ofMesh & mesh, TreeNode & node, int numLevels, int level);
-	bool intersect(const ofVec3f &, const TreeNode & node, TreeNode & nodeRtn);
-	bool intersect(const Ray &, const TreeNode &, vector<TreeNode> &);
-	bool intersect(const Ray &, const TreeNode &, TreeNode &);
+	void subdivideParallel(TaskPool & pool, const ofMesh & mesh, TreeNode & node, int numLevels, int level);
+	bool intersect(const ofVec3f &, const TreeNode & node, const TreeNode *& nodeRtn);
+	bool intersect(const Ray &, const TreeNode &, vector<const TreeNode *> &);
+	bool intersect(const Ray &, const TreeNode &, const TreeNode *&);
+	void intersect(const PickCone &, const TreeNode &, vector<PickPoint> &);
 
-	void draw(TreeNode & node, int numLevels, int level);
-	void draw(int numLevels, int level) {
-		draw(root, numLevels, level);
+	// flat layout builder (in-place partitioning of one shared index array)
+	//
+	void createFlat(int numLevels);
+	void buildSubtree(vector<FlatNode> & out, int node, int numLevels, int level);
+	void splitNode(vector<FlatNode> & out, int node);
+	static Box octantBox(const Box & box, int octant);
+	void initPrimitives();
+	void fitTriangleBounds();
+	int levelLimit(const Box & bounds) const;
+	int applyMemoryBudget(size_t budget);
+	int collapseChains();
+	static int collapseChains(TreeNode & node);
+	static int collapseChains(vector<FlatNode> & out);
+	void compactNodes(const vector<char> & keep);
+	static void compactNodes(vector<FlatNode> & out, const vector<char> & keep);
+	bool compactIndices();
+	void createMorton(int numLevels);
+	template <class Key> void buildMorton(int numLevels);
+
+	// on-disk cache of the flat layout.  createCached() maps the cache file at
+	// "path" if its key matches the mesh, build policy and type, otherwise it
+	// builds the tree and rewrites the file.  Returns true on a cache hit.
+	//
+	bool createCached(const ofMesh & mesh, const OctreeBuildParams & params, const string & path, OctreeBuildType type = PartitionBuild);
+	bool createCached(const ofMesh & mesh, int numLevels, const string & path, OctreeBuildType type = PartitionBuild) {
+		OctreeBuildParams params;
+		params.maxLevels = numLevels;
+		return createCached(mesh, params, path, type);
+	}
+	uint64_t cacheKey(const ofMesh & mesh, const OctreeBuildParams & params, OctreeBuildType type) const;
+	bool save(const string & path, uint64_t key) const;
+	bool load(const string & path, uint64_t key);
+	void release();
+
+	// queries over the flat layout; nodes are referred to by their index in "nodes".
+	// point() reads entry p of a leaf's run in either index format ("base" is
+	// the leaf's firstChild).
+	//
+	int point(int base, int p) const { return offsets.size() ? base + offsets[p] : indices[p]; }
+	bool intersect(const ofVec3f &, int node, int & nodeRtn);
+	bool intersect(const Ray &, int node, vector<int> &);
+	bool intersect(const Ray &, int node, int & nodeRtn);
+	bool intersect(const Box &, int node, vector<int> & nodesRtn);
+
+	// the same queries from the root, returning handles.  The collect version
+	// clears "refs" first, so a vector kept across frames stops allocating.
+	//
+	NodeRef ref(int node) const;
+	bool intersect(const ofVec3f &, NodeRef & nodeRtn) override;
+	bool intersect(const Ray &, NodeRef & nodeRtn);
+	bool intersect(const Ray &, vector<NodeRef> & refs) override;
+	int intersect(const PickCone & cone, vector<PickPoint> & points) override;
+
+	// coherent point queries: the cursor's leaf is tested first, then the
+	// leaves behind the faces the point crossed, then the rest of the tree
+	// climbing one ancestor at a time
+	//
+	bool intersect(const ofVec3f & p, QueryCursor & cursor, NodeRef & nodeRtn) override;
+	bool intersect(const ofVec3f & p, int node, int skip, int & nodeRtn, int & boxTests);
+	void linkNodes();
+	void linkChildren(int node);
+	int linkAcross(int parent, int octant, int face) const;
+	int live(int node) const {
+		while (node >= 0 && nodes[node].numChildren < 0) node = nodes[node].firstChild;
+		return node;
+	}
+
+	// nearest exact hit along a ray, or of a sphere swept along it, for t in
+	// (tMin, tMax)
+	//
+	bool intersect(const Ray & ray, OctreeHit & hit, float tMin = 0, float tMax = FLT_MAX) override {
+		return sweep(ray, 0, hit, tMin, tMax);
+	}
+	bool sweep(const Ray &, float radius, OctreeHit & hit, float tMin = 0, float tMax = FLT_MAX) override;
+	void sweep(const Ray &, float radius, int node, float tMin, OctreeHit & hit);
+	using SpatialIndex::sweep;
+	void intersectLeaf(const Ray &, float radius, int node, float tMin, OctreeHit & hit);
+
+	// batch version of the nearest hit query.  Every run of eight rays of the
+	// batch goes down the tree as one packet: each node is fetched and its
+	// children slab tested once for all the rays still inside it, and the
+	// children are visited in the order of the first ray's direction.  Where
+	// fewer than minPacketRays rays are left in a node they finish its subtree
+	// one at a time, so incoherent batches cost about what single rays do.
+	//
+	int intersect(const RayBatch & rays, vector<OctreeHit> & hits, float tMin = 0, float tMax = FLT_MAX) override;
+	void intersectPacket(const RayPacket & packet, OctreeHit * hits, float tMin);
+	static const int minPacketRays = 4;		// below this many rays a packet splits up
+
+	// contacts of "model", a triangle tree over a mesh in its own space
+	// placed in the world by "transform", with this (triangle) tree.  Both
+	// trees are walked at once from their roots: a pair of nodes goes on
+	// only if their boxes overlap (the model box taken to the world as the
+	// box around its transformed corners), splitting the larger of the two,
+	// and triangles are only tested for pairs of overlapping leaves.  The
+	// model's node boxes thus act as its coarse proxy; the full mesh is only
+	// read where they touch the terrain.  Returns the number of contacts.
+	//
+	int collide(const Octree & model, const glm::mat4 & transform, vector<MeshContact> & contacts) const;
+
+	static int childSlot(int childMask, int octant) {
+		int below = childMask & ((1 << octant) - 1);
+		int slot = 0;
+		for (; below; below &= below - 1) slot++;
+		return slot;
 	}
-	void drawLeafNodes(TreeNode & node);
-	void drawLeafNodes() { drawLeafNodes(root); };
-	static void drawBox(const Box &box);
+	static const int maxDepth = 21;				// deepest build, whatever maxLevels asks for
+	static const int maxStack = 8 * (maxDepth + 3);		// 8 children per level
+
+	// incremental updates of the flat layout, for terrain that deforms.
+	// update() moves mesh vertices, with the copies of them at the same
+	// position, recomputes the normals around them and repairs the tree: a
+	// primitive still inside its leaf's cell only refits that leaf and its
+	// ancestors, and one that left it is rebucketed by rebuilding the subtree
+	// of the lowest ancestor whose cell holds it, with the build policy, so
+	// leaves split and merge as their counts cross maxLeafSize.  Subtrees past
+	// rebuildLimit are not rebuilt; the primitive stays in its leaf and the
+	// leaf grows.  The cost follows the edited region, not the mesh.  The first
+	// update copies a mapped or compact tree into owned 32 bit stores, and
+	// every update invalidates NodeRefs.  The memory budget is not applied to
+	// rebuilt subtrees.
+	//
+	OctreeUpdateStats update(const vector<int> & vertices, const vector<glm::vec3> & positions);
+	void prepareUpdates();
+	void linkVertices();
+	void moveVertices(const vector<int> & vertices, const vector<glm::vec3> & positions, vector<int> & moved);
+	void updateNormals(const vector<int> & moved);
+	void rebuildSubtree(int node);
+	bool refit(int node);
+	void assignLeaves();
+	void compactDeadNodes();
+
+	// debug views, drawn from boxLines and rebuilt when revision moves on
+	//
+	void draw(int numLevels, int level) override {
+		updateBoxLines();
+		boxLines.draw(level, numLevels);
+	}
+	void drawLeafNodes() override {
+		updateBoxLines();
+		boxLines.drawLeaves();
+	}
+	void updateBoxLines();
+	void addBoxes(const TreeNode & node, int level);
+	void addBoxes(int node, int level);
 	static Box meshBounds(const ofMesh &);
 	int getMeshPointsInBox(const ofMesh &mesh, const vector<int> & points, Box & box, vector<int> & pointsRtn);
 	void subDivideBox8(const Box &b, vector<Box> & boxList);
 
+	// size statistics for whichever layout is active
+	//
+	int numNodes() const override;
+	size_t memoryUsage() const override;
+	static int numNodes(const TreeNode &node);
+	static size_t memoryUsage(const TreeNode &node);
+
 	ofMesh mesh;
 	TreeNode root;
-};
\ No newline at end of file
+
+	// build threads: 1 builds serially, 0 uses every hardware thread.  Subtrees
+	// above parallelLevels are spread over the task pool; deeper ones are
+	// built serially inside their task.
+	//
+	int numThreads = 1;
+	int parallelLevels = 3;
+	OctreeBuildParams buildParams;		// policy of the last create()
+
+	// flat layout, built by create() when bLinear is set.  "nodes" and either
+	// "indices" or, for a compact tree, "offsets" view the owned stores below
+	// or a mapped cache file.
+	//
+	bool bLinear = true;
+	OctreePrimitiveType primitives = VertexPrimitives;
+	ArrayView<FlatNode> nodes;
+	ArrayView<int> indices;
+	ArrayView<uint16_t> offsets;
+	vector<FlatNode> nodeStore;
+	vector<int> indexStore;
+	vector<uint16_t> offsetStore;
+
+	// links for the query cursor, rebuilt by linkNodes() after every build or
+	// cache load.  neighbors holds 6 entries per node (-x, +x, -y, +y, -z, +z):
+	// the smallest node at the same level or above whose cell touches that
+	// face, or -1 at the edge of the tree.  After an update() a link can
+	// lead to a dead node; live() follows it to the rebuilt node that
+	// replaced it.
+	//
+	vector<int> parents;
+	vector<int> neighbors;
+
+	vector<unsigned char> octants;		// scratch octant codes, alive during the build and once updates start
+	vector<glm::vec3> centroidStore;	// scratch triangle centroids, alive during the build and once updates start
+	const glm::vec3 * centers = nullptr;
+	int numCenters = 0;
+
+	// update state, set up by the first update().  cells holds the cell of
+	// every node (the box before it was grown to its triangles), leafOf the
+	// leaf of every primitive and vertexTriangles the triangles around every
+	// vertex (those of vertex v start at vertexTriangleStart[v]).  sameVertex
+	// links the vertices at one position (the mesh repeats them along seams)
+	// in a ring, so update() moves them together.  Rebuilt subtrees leave their old nodes in
+	// nodeStore, marked with numChildren -1 and firstChild pointing at the
+	// rebuilt node, until they outnumber the live ones.  revision changes
+	// whenever the tree does (build, cache load, update), for anything
+	// derived from it.
+	//
+	vector<Box> cells;
+	vector<int> leafOf;
+	vector<int> vertexTriangleStart;
+	vector<int> vertexTriangles;
+	vector<int> sameVertex;
+	int updateLevels = 0;				// depth limit of rebuilt subtrees, that of the build
+	int rebuildLimit = 4096;			// largest subtree (in primitives) an update rebuilds
+	int deadNodes = 0;
+	int revision = 0;
+	BoxLines boxLines;					// node outlines for the debug views
+
+	// cache file mapping (copy on write, so the mapped tree stays writable)
+	//
+	void * mapAddress = nullptr;
+	size_t mapLength = 0;
+	void * mapHandle = nullptr;
+};
@@ -39,6 +39,7 @@ class GravityForce: public ParticleForce {
 	ofVec3f gravity;
 public:
 	void set(const ofVec3f &g) { gravity = g; }
+	ofVec3f acceleration() const { return gravity; }
 	GravityForce(const ofVec3f & gravity);
 	GravityForce() {}
 	void updateForce(Particle *);
@@ -78,6 +79,7 @@ class ThrustForce : public ParticleForce {
 	ofVec3f direction;
 public:
 	void set(ofVec3f dir, float mag) { magnitude = mag; direction = dir; }
+	ofVec3f acceleration() const { return direction * magnitude; }
 	ThrustForce(ofVec3f dir);
 	ThrustForce() {}
 	void updateForce(Particle *);
@@ -0,0 +1,106 @@
+#include "RayPacket.h"
+#include <cmath>
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define RAYPACKET_SSE2
+#endif
+
+void RayPacket::set(const Ray * r, int n) {
+	count = n;
+	lanes = (1 << n) - 1;
+	for (int i = 0; i < maxRays; i++) {
+		rays[i] = r[i < n ? i : n - 1];
+		for (int k = 0; k < 3; k++) {
+			origin[k][i] = rays[i].origin[k];
+			invDirection[k][i] = rays[i].inv_direction[k];
+			negative[k][i] = rays[i].sign[k] ? -1 : 0;
+		}
+	}
+}
+
+// The box is the same for every lane, but each lane enters it through the
+// side its own direction sign picks: both slab distances are computed and
+// the sign mask swaps them.  The folds keep the running bound as the second
+// operand so a NaN slab leaves it unchanged, as in Box8.
+//
+#if defined(__AVX__)
+
+int RayPacket::intersect(const Box & box, float t0, const float t1[8], float tEntry[8]) const {
+	__m256 tmin = _mm256_set1_ps(-INFINITY);
+	__m256 tmax = _mm256_set1_ps(INFINITY);
+	for (int k = 0; k < 3; k++) {
+		__m256 o = _mm256_loadu_ps(origin[k]);
+		__m256 inv = _mm256_loadu_ps(invDirection[k]);
+		__m256 neg = _mm256_loadu_ps((const float *)negative[k]);
+		__m256 tLo = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(box.parameters[0][k]), o), inv);
+		__m256 tHi = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(box.parameters[1][k]), o), inv);
+		tmin = _mm256_max_ps(_mm256_blendv_ps(tLo, tHi, neg), tmin);
+		tmax = _mm256_min_ps(_mm256_blendv_ps(tHi, tLo, neg), tmax);
+	}
+	__m256 overlap = _mm256_cmp_ps(tmin, tmax, _CMP_LE_OQ);
+	__m256 before = _mm256_cmp_ps(tmin, _mm256_loadu_ps(t1), _CMP_LT_OQ);
+	__m256 after = _mm256_cmp_ps(tmax, _mm256_set1_ps(t0), _CMP_GT_OQ);
+	int mask = _mm256_movemask_ps(_mm256_and_ps(overlap, _mm256_and_ps(before, after)));
+	_mm256_storeu_ps(tEntry, _mm256_max_ps(tmin, _mm256_set1_ps(t0)));
+	return mask & lanes;
+}
+
+const char * RayPacket::kernel() { return "avx"; }
+
+#elif defined(RAYPACKET_SSE2)
+
+static inline __m128 select(__m128 mask, __m128 a, __m128 b) {
+	return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+}
+
+int RayPacket::intersect(const Box & box, float t0, const float t1[8], float tEntry[8]) const {
+	int mask = 0;
+	for (int h = 0; h < 2; h++) {
+		__m128 tmin = _mm_set1_ps(-INFINITY);
+		__m128 tmax = _mm_set1_ps(INFINITY);
+		for (int k = 0; k < 3; k++) {
+			__m128 o = _mm_loadu_ps(origin[k] + 4 * h);
+			__m128 inv = _mm_loadu_ps(invDirection[k] + 4 * h);
+			__m128 neg = _mm_loadu_ps((const float *)negative[k] + 4 * h);
+			__m128 tLo = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(box.parameters[0][k]), o), inv);
+			__m128 tHi = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(box.parameters[1][k]), o), inv);
+			tmin = _mm_max_ps(select(neg, tHi, tLo), tmin);
+			tmax = _mm_min_ps(select(neg, tLo, tHi), tmax);
+		}
+		__m128 overlap = _mm_cmple_ps(tmin, tmax);
+		__m128 before = _mm_cmplt_ps(tmin, _mm_loadu_ps(t1 + 4 * h));
+		__m128 after = _mm_cmpgt_ps(tmax, _mm_set1_ps(t0));
+		mask |= _mm_movemask_ps(_mm_and_ps(overlap, _mm_and_ps(before, after))) << (4 * h);
+		_mm_storeu_ps(tEntry + 4 * h, _mm_max_ps(tmin, _mm_set1_ps(t0)));
+	}
+	return mask & lanes;
+}
+
+const char * RayPacket::kernel() { return "sse2"; }
+
+#else
+
+int RayPacket::intersect(const Box & box, float t0, const float t1[8], float tEntry[8]) const {
+	int mask = 0;
+	for (int i = 0; i < maxRays; i++) {
+		float tmin = -INFINITY;
+		float tmax = INFINITY;
+		for (int k = 0; k < 3; k++) {
+			float tLo = (box.parameters[0][k] - origin[k][i]) * invDirection[k][i];
+			float tHi = (box.parameters[1][k] - origin[k][i]) * invDirection[k][i];
+			float tNear = negative[k][i] ? tHi : tLo;
+			float tFar = negative[k][i] ? tLo : tHi;
+			tmin = tNear > tmin ? tNear : tmin;
+			tmax = tFar < tmax ? tFar : tmax;
+		}
+		if (tmin <= tmax && tmin < t1[i] && tmax > t0) mask |= 1 << i;
+		tEntry[i] = tmin > t0 ? tmin : t0;
+	}
+	return mask & lanes;
+}
+
+const char * RayPacket::kernel() { return "scalar"; }
+
+#endif
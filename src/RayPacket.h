@@ -0,0 +1,30 @@
+#pragma once
+#include "ray.h"
+#include "box.h"
+
+//  Up to eight rays traced through a tree together, one per lane.  The
+//  origins, inverse directions and direction signs are kept per axis as
+//  structure of arrays, so one node box is slab tested against every lane
+//  at once: intersect() returns a bit mask of the lanes whose ray hits the
+//  box with an overlap in (t0, t1[lane]), and their entry distances (clamped
+//  to t0) in tEntry, under the same conditions as Box::intersect.  The rays
+//  themselves stay around for the leaf tests.
+//
+//  The kernel is picked at compile time like Box8's.  Lanes at or past
+//  "count" repeat the last ray; mask them out with "lanes".
+//
+class RayPacket {
+public:
+	static const int maxRays = 8;
+
+	void set(const Ray * r, int n);
+	int intersect(const Box & box, float t0, const float t1[8], float tEntry[8]) const;
+	static const char * kernel();
+
+	Ray rays[maxRays];
+	float origin[3][maxRays];
+	float invDirection[3][maxRays];
+	int negative[3][maxRays];		// all bits set where the direction is negative
+	int count = 0;
+	int lanes = 0;					// bit mask of the lanes in use
+};
@@ -0,0 +1,312 @@
+#include "SpatialIndex.h"
+
+// the draw color of boxes at a given tree level
+//
+ofColor SpatialIndex::levelColor(int level) {
+	switch (level) {
+	case 0:
+		return ofColor::lightBlue;
+	case 1:
+		return ofColor::red;
+	case 2:
+		return ofColor::green;
+	case 3:
+		return ofColor::brown;
+	case 4:
+		return ofColor::yellow;
+	case 5:
+		return ofColor::blue;
+	case 6:
+		return ofColor::pink;
+	case 7:
+		return ofColor::orange;
+	case 8:
+		return ofColor::white;
+	default:
+		return ofColor::lightYellow;
+	}
+}
+
+// Moller-Trumbore ray/triangle intersection; "t" is the ray parameter of the hit
+//
+bool SpatialIndex::rayTriangle(const Ray & ray, const glm::vec3 & v0, const glm::vec3 & v1, const glm::vec3 & v2, float & t) {
+	const float eps = 1e-9f;
+	glm::vec3 dir(ray.direction.x(), ray.direction.y(), ray.direction.z());
+	glm::vec3 e1 = v1 - v0;
+	glm::vec3 e2 = v2 - v0;
+	glm::vec3 p = glm::cross(dir, e2);
+	float det = glm::dot(e1, p);
+	if (fabs(det) < eps) return false;
+	float invDet = 1 / det;
+	glm::vec3 s = glm::vec3(ray.origin.x(), ray.origin.y(), ray.origin.z()) - v0;
+	float u = glm::dot(s, p) * invDet;
+	if (u < 0 || u > 1) return false;
+	glm::vec3 q = glm::cross(s, e1);
+	float v = glm::dot(dir, q) * invDet;
+	if (v < 0 || u + v > 1) return false;
+	t = glm::dot(e2, q) * invDet;
+	return true;
+}
+
+// test triangle "triangle" of the mesh, keeping the hit if it is closer than
+// "hit".  The normal is turned to face the ray origin; hit.node is left for
+// the caller.
+//
+bool SpatialIndex::hitTriangle(const ofMesh & mesh, const Ray & ray, int triangle, float tMin, OctreeHit & hit) {
+	const vector<glm::vec3> & verts = mesh.getVertices();
+	const glm::vec3 & v0 = verts[mesh.getIndex(triangle * 3)];
+	const glm::vec3 & v1 = verts[mesh.getIndex(triangle * 3 + 1)];
+	const glm::vec3 & v2 = verts[mesh.getIndex(triangle * 3 + 2)];
+	float dist;
+	if (!rayTriangle(ray, v0, v1, v2, dist) || dist <= tMin || dist >= hit.distance) return false;
+
+	glm::vec3 dir(ray.direction.x(), ray.direction.y(), ray.direction.z());
+	glm::vec3 normal = glm::normalize(glm::cross(v1 - v0, v2 - v0));
+	if (glm::dot(normal, dir) > 0) normal = normal * -1.0f;
+	hit.distance = dist;
+	hit.triangle = triangle;
+	hit.normal = normal;
+	return true;
+}
+
+PickCone::PickCone(const ofVec3f & eye, const ofVec3f & axis, float coneSlope) {
+	origin = eye;
+	direction = glm::normalize(glm::vec3(axis));
+	slope = coneSlope;
+	cosAngle = 1 / sqrt(1 + slope * slope);
+	sinAngle = slope * cosAngle;
+}
+
+// "p" is inside the cone (in front of the eye); "depth" is its distance
+// along the axis
+//
+bool PickCone::contains(const glm::vec3 & p, float & depth) const {
+	glm::vec3 v = p - origin;
+	depth = glm::dot(v, direction);
+	if (depth <= 0) return false;
+	glm::vec3 radial = v - direction * depth;
+	return glm::dot(radial, radial) <= slope * slope * depth * depth;
+}
+
+// the box's bounding sphere reaches into the cone: its center is no
+// further than its radius from the cone's surface (and not behind the eye)
+//
+bool PickCone::intersects(const Box & box) const {
+	Vector3 lo = box.min();
+	Vector3 hi = box.max();
+	glm::vec3 center((lo.x() + hi.x()) / 2, (lo.y() + hi.y()) / 2, (lo.z() + hi.z()) / 2);
+	glm::vec3 half((hi.x() - lo.x()) / 2, (hi.y() - lo.y()) / 2, (hi.z() - lo.z()) / 2);
+	float radius = glm::length(half);
+	glm::vec3 v = center - origin;
+	float depth = glm::dot(v, direction);
+	if (depth < -radius) return false;
+	float distance = glm::length(v - direction * depth);
+	return distance * cosAngle - depth * sinAngle <= radius;
+}
+
+// drop repeats of a vertex (triangle leaves list a vertex once per
+// triangle) and order the picks nearest first
+//
+void SpatialIndex::sortPicks(vector<PickPoint> & points) {
+	sort(points.begin(), points.end(), [](const PickPoint & a, const PickPoint & b) { return a.vertex < b.vertex; });
+	points.erase(unique(points.begin(), points.end(), [](const PickPoint & a, const PickPoint & b) { return a.vertex == b.vertex; }), points.end());
+	sort(points.begin(), points.end(), [](const PickPoint & a, const PickPoint & b) { return a.depth < b.depth; });
+}
+
+int SpatialIndex::intersect(const RayBatch & rays, vector<OctreeHit> & hits, float tMin, float tMax) {
+	int n = rays.size();
+	hits.resize(n);
+	int count = 0;
+	for (int i = 0; i < n; i++) {
+		if (intersect(rays.ray(i), hits[i], tMin, tMax)) count++;
+		else hits[i].node = -1;
+	}
+	return count;
+}
+
+// sweep:  the segment (radius 0) or capsule from "from" to "to".  The hit
+//         distance is in world units along the segment; divide by its length
+//         for the fraction of the step taken before contact.
+//
+bool SpatialIndex::sweep(const ofVec3f & from, const ofVec3f & to, float radius, OctreeHit & hit) {
+	ofVec3f d = to - from;
+	float length = d.length();
+	if (length <= 0) {
+		hit.distance = 0;
+		hit.node = -1;
+		return false;
+	}
+	d /= length;
+	Ray ray(Vector3(from.x, from.y, from.z), Vector3(d.x, d.y, d.z));
+	return sweep(ray, radius, hit, 0, length);
+}
+
+// sweep:  march a trajectory in straight chords.  Each chord is swept as a
+//         capsule grown by the path's chord error, which holds the curved
+//         piece, so a miss clears it for sure and the next chord is twice as
+//         long; empty sky goes by in a few large steps.  A chord that touches
+//         is halved until its error is below the tolerance, and its contact
+//         (the bare chord's, when that touches too) is the impact, a little
+//         early if anything.  The error is capped at a few tolerances: a fat
+//         capsule that reaches the ground tests far more triangles than the
+//         steps it saves.
+//
+bool SpatialIndex::sweep(const Trajectory & path, float radius, float duration, float tolerance, TrajectoryHit & hit) {
+	const float maxError = 4 * tolerance;
+	const float minStep = duration * 1e-6f;
+	hit.sweeps = 0;
+	float t = 0;
+	float h = duration;
+	OctreeHit contact;
+	while (t < duration) {
+		h = std::min(h, duration - t);
+		ofVec3f from = path.at(t);
+		ofVec3f to = path.at(t + h);
+		float error = path.chordError(t, h);
+		if (error > maxError && h > minStep) {
+			h /= 2;
+			continue;
+		}
+		hit.sweeps++;
+		if (!sweep(from, to, radius + error, contact)) {
+			t += h;
+			h *= 2;
+			continue;
+		}
+		if (error > tolerance && h > minStep) {
+			h /= 2;
+			continue;
+		}
+
+		OctreeHit exact;
+		if (error > 0 && sweep(from, to, radius, exact)) contact = exact;
+		float length = from.distance(to);
+		hit.time = length > 0 ? t + h * contact.distance / length : t;
+		hit.point = contact.point;
+		hit.normal = contact.normal;
+		hit.velocity = path.velocityAt(hit.time);
+		hit.slope = ofRadToDeg(acos(ofClamp(contact.normal.y, -1, 1)));
+		return true;
+	}
+	return false;
+}
+
+// first t >= tMin where a sphere of "radius" centered on the ray touches
+// point "p".  A sphere already around p and moving closer touches at tMin.
+//
+bool SpatialIndex::sweepPoint(const Ray & ray, float radius, const glm::vec3 & p, float tMin, float & t) {
+	glm::vec3 dir(ray.direction.x(), ray.direction.y(), ray.direction.z());
+	glm::vec3 m = glm::vec3(ray.origin.x(), ray.origin.y(), ray.origin.z()) + dir * tMin - p;
+	float a = glm::dot(dir, dir);
+	float b = glm::dot(m, dir);
+	float c = glm::dot(m, m) - radius * radius;
+	if (c <= 0) {
+		if (b >= 0) return false;
+		t = tMin;
+		return true;
+	}
+	if (b >= 0) return false;
+	float disc = b * b - a * c;
+	if (disc < 0) return false;
+	t = tMin + (-b - sqrt(disc)) / a;
+	return true;
+}
+
+// sweepTriangle:  first contact of a sphere moving along the ray with
+//                 triangle "triangle": against the face plane offset by the
+//                 radius, then against the edges (cylinders) and corners
+//                 (spheres) where the face contact falls outside.  Keeps the
+//                 contact if it is closer than "hit".
+//
+bool SpatialIndex::sweepTriangle(const ofMesh & mesh, const Ray & ray, float radius, int triangle, float tMin, OctreeHit & hit) {
+	const vector<glm::vec3> & verts = mesh.getVertices();
+	glm::vec3 v[3] = {
+		verts[mesh.getIndex(triangle * 3)],
+		verts[mesh.getIndex(triangle * 3 + 1)],
+		verts[mesh.getIndex(triangle * 3 + 2)]
+	};
+	glm::vec3 dir(ray.direction.x(), ray.direction.y(), ray.direction.z());
+	glm::vec3 origin(ray.origin.x(), ray.origin.y(), ray.origin.z());
+	glm::vec3 cross = glm::cross(v[1] - v[0], v[2] - v[0]);
+	float area = glm::dot(cross, cross);
+	if (area <= 0) return false;
+	glm::vec3 n = cross / sqrt(area);
+	glm::vec3 start = origin + dir * tMin;
+	float side = glm::dot(start - v[0], n);
+	if (side < 0) {
+		n = n * -1.0f;
+		side = -side;
+	}
+	float approach = glm::dot(dir, n);
+
+	// face: the center reaches the plane pushed out by the radius, and the
+	// contact point below it lies inside the triangle.  Nothing on the rim
+	// can be touched before that.
+	//
+	if (approach < 0) {
+		float t = side <= radius ? tMin : tMin + (side - radius) / -approach;
+		glm::vec3 contact = origin + dir * t - n * std::min(side, radius);
+		glm::vec3 c0 = glm::cross(v[1] - v[0], contact - v[0]);
+		glm::vec3 c1 = glm::cross(v[2] - v[1], contact - v[1]);
+		glm::vec3 c2 = glm::cross(v[0] - v[2], contact - v[2]);
+		if (glm::dot(c0, cross) >= 0 && glm::dot(c1, cross) >= 0 && glm::dot(c2, cross) >= 0) {
+			if (t >= hit.distance) return false;
+			hit.distance = t;
+			hit.triangle = triangle;
+			hit.normal = n;
+			return true;
+		}
+	}
+
+	float best = hit.distance;
+	glm::vec3 bestNormal;
+	bool bFound = false;
+
+	// edges: solve |(m + t d) x e|^2 = r^2 |e|^2 for the cylinder around each
+	// edge, keeping roots whose closest edge point lies within the edge
+	//
+	for (int k = 0; k < 3; k++) {
+		glm::vec3 p = v[k];
+		glm::vec3 e = v[(k + 1) % 3] - p;
+		glm::vec3 m = start - p;
+		float ee = glm::dot(e, e);
+		float ed = glm::dot(e, dir);
+		float em = glm::dot(e, m);
+		float a = ee * glm::dot(dir, dir) - ed * ed;
+		float b = ee * glm::dot(m, dir) - em * ed;
+		float c = ee * (glm::dot(m, m) - radius * radius) - em * em;
+		if (a <= 1e-12f * ee || b >= 0) continue;
+		float t;
+		if (c <= 0) t = 0;
+		else {
+			float disc = b * b - a * c;
+			if (disc < 0) continue;
+			t = (-b - sqrt(disc)) / a;
+		}
+		float s = (em + t * ed) / ee;
+		if (s < 0 || s > 1) continue;
+		t += tMin;
+		if (t < best) {
+			best = t;
+			bestNormal = glm::normalize(origin + dir * t - (p + e * s));
+			bFound = true;
+		}
+	}
+
+	// corners
+	//
+	for (int k = 0; k < 3; k++) {
+		float t;
+		if (sweepPoint(ray, radius, v[k], tMin, t) && t < best) {
+			best = t;
+			bestNormal = glm::normalize(origin + dir * t - v[k]);
+			bFound = true;
+		}
+	}
+
+	if (!bFound) return false;
+	hit.distance = best;
+	hit.triangle = triangle;
+	hit.normal = bestNormal;
+	return true;
+}
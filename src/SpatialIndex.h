@@ -0,0 +1,184 @@
+#pragma once
+#include "ofMain.h"
+#include <cfloat>
+#include "box.h"
+#include "ray.h"
+#include "Trajectory.h"
+
+//  Handle to a leaf returned by the queries: the node id and the node's run
+//  of the index's primitive array (vertex ids, or triangle ids for triangle
+//  leaves).  Nothing is copied, so the handle is only good until the index
+//  is rebuilt or released.  Runs of a compact octree are 16 bit offsets from
+//  "base"; point() reads either kind, begin() and end() only 32 bit runs.
+//
+class NodeRef {
+public:
+	bool valid() const { return node >= 0; }
+	int size() const { return numPoints; }
+	int point(int i) const { return offsets ? base + offsets[i] : points[i]; }
+	const int * begin() const { return points; }
+	const int * end() const { return points + numPoints; }
+
+	int node = -1;
+	const int * points = nullptr;
+	const uint16_t * offsets = nullptr;
+	int base = 0;
+	int numPoints = 0;
+};
+
+//  Result of a nearest-hit ray query.  distance is the ray parameter of the
+//  hit (world distance when the ray direction has unit length) and the normal
+//  is the face normal, turned to face the ray origin.  In vertex mode the hit
+//  is the leaf vertex nearest the ray origin, triangle is -1 and the normal is
+//  the vertex normal.
+//
+class OctreeHit {
+public:
+	ofVec3f point;
+	ofVec3f normal;
+	float distance;
+	int triangle;
+	int node;
+};
+
+//  Rays for the batch queries, in structure of arrays form: one array per
+//  component of the origins and of the directions.  Neighboring rays are
+//  traced together, so add them in a coherent order (along a scan line of a
+//  sensor fan, pixel by pixel).
+//
+class RayBatch {
+public:
+	void clear() {
+		for (int k = 0; k < 3; k++) {
+			origin[k].clear();
+			direction[k].clear();
+		}
+	}
+	void reserve(int n) {
+		for (int k = 0; k < 3; k++) {
+			origin[k].reserve(n);
+			direction[k].reserve(n);
+		}
+	}
+	void add(const ofVec3f & o, const ofVec3f & d) {
+		for (int k = 0; k < 3; k++) {
+			origin[k].push_back(o[k]);
+			direction[k].push_back(d[k]);
+		}
+	}
+	int size() const { return origin[0].size(); }
+	Ray ray(int i) const {
+		return Ray(Vector3(origin[0][i], origin[1][i], origin[2][i]), Vector3(direction[0][i], direction[1][i], direction[2][i]));
+	}
+
+	vector<float> origin[3];
+	vector<float> direction[3];
+};
+
+//  Where the last point query of one moving body ended up.  Passing the
+//  same cursor back lets the index start next to the previous leaf instead
+//  of at the root; keep one cursor per tracked body.
+//
+class QueryCursor {
+public:
+	int node = -1;
+	int boxTests = 0;			// boxes tested by the last query, for profiling
+};
+
+//  Cone around a pick ray for screen space selection: the apex at the eye,
+//  the axis through the picked pixel and "slope" the cone's radius per unit
+//  of depth along the axis.  A pick "pixels" wide around the center of a
+//  perspective view of vertical field of view "fov" and "height" pixels has
+//  slope pixels * 2 tan(fov / 2) / height; pixels off center cover a little
+//  less, so the cone holds the pick anywhere on the screen.
+//
+class PickCone {
+public:
+	PickCone(const ofVec3f & eye, const ofVec3f & axis, float slope);
+	bool contains(const glm::vec3 & p, float & depth) const;
+	bool intersects(const Box & box) const;
+
+	glm::vec3 origin;
+	glm::vec3 direction;			// unit length
+	float slope;
+	float cosAngle;
+	float sinAngle;
+};
+
+//  A vertex found by a pick, with its depth along the pick axis
+//
+class PickPoint {
+public:
+	ofVec3f point;
+	float depth;
+	int vertex;
+};
+
+//  The queries the app runs against the terrain, so the octree and the BVH
+//  can be swapped at startup: point containment (ground contact), nearest
+//  ray hit (altitude, picking) and collecting every leaf along a ray.
+//
+class SpatialIndex {
+public:
+	virtual ~SpatialIndex() {}
+
+	virtual bool intersect(const ofVec3f &, NodeRef & nodeRtn) = 0;
+	virtual bool intersect(const Ray &, OctreeHit & hit, float tMin = 0, float tMax = FLT_MAX) = 0;
+
+	// continuous collision: a sphere of "radius" swept along the ray (0 sweeps
+	// a point, i.e. the plain ray query).  hit.distance is the ray parameter
+	// of first contact, hit.point the sphere center there and hit.normal
+	// points from the surface to the center.  A sphere already touching a
+	// surface it moves into hits at tMin.
+	//
+	virtual bool sweep(const Ray &, float radius, OctreeHit & hit, float tMin = 0, float tMax = FLT_MAX) = 0;
+	bool sweep(const ofVec3f & from, const ofVec3f & to, float radius, OctreeHit & hit);
+
+	// first contact of a sphere following a curved path within "duration"
+	// seconds, to within "tolerance" of the path
+	//
+	bool sweep(const Trajectory & path, float radius, float duration, float tolerance, TrajectoryHit & hit);
+	virtual bool intersect(const Ray &, vector<NodeRef> & refs) = 0;
+
+	// mesh vertices inside a pick cone, each once, nearest first.  Nodes
+	// whose bounds miss the cone are skipped whole, so the cost follows the
+	// size of the pick and not of the mesh.  Returns the number found.
+	//
+	virtual int intersect(const PickCone & cone, vector<PickPoint> & points) = 0;
+
+	// nearest hit of every ray of a batch; "hits" is resized to the batch and
+	// rays that miss get node -1.  Returns the number of rays that hit.  The
+	// default traces the rays one at a time.
+	//
+	virtual int intersect(const RayBatch & rays, vector<OctreeHit> & hits, float tMin = 0, float tMax = FLT_MAX);
+
+	// point containment starting from the cursor's leaf.  The default has no
+	// links to follow and starts from the root every time.
+	//
+	virtual bool intersect(const ofVec3f & p, QueryCursor & cursor, NodeRef & nodeRtn) {
+		cursor.boxTests = 0;
+		if (!intersect(p, nodeRtn)) return false;
+		cursor.node = nodeRtn.node;
+		return true;
+	}
+
+	// debug views: node boxes of levels "level" to numLevels - 1 in their
+	// level colors, or the leaf boxes in the current color
+	//
+	virtual void draw(int numLevels, int level) = 0;
+	virtual void drawLeafNodes() = 0;
+	virtual int numNodes() const = 0;
+	virtual size_t memoryUsage() const = 0;
+
+	static ofColor levelColor(int level);
+	static bool rayTriangle(const Ray &, const glm::vec3 & v0, const glm::vec3 & v1, const glm::vec3 & v2, float & t);
+	static bool hitTriangle(const ofMesh & mesh, const Ray &, int triangle, float tMin, OctreeHit & hit);
+	static bool sweepTriangle(const ofMesh & mesh, const Ray &, float radius, int triangle, float tMin, OctreeHit & hit);
+	static bool sweepPoint(const Ray &, float radius, const glm::vec3 & p, float tMin, float & t);
+	static void sortPicks(vector<PickPoint> & points);
+	static bool intersectBox(const Box & box, const Ray & ray, float radius, float t0, float t1, float & tEntry) {
+		if (radius == 0) return box.intersect(ray, t0, t1, tEntry);
+		Vector3 pad(radius, radius, radius);
+		return Box(box.parameters[0] - pad, box.parameters[1] + pad).intersect(ray, t0, t1, tEntry);
+	}
+};
@@ -0,0 +1,118 @@
+#include "TaskPool.h"
+
+// index of the queue owned by the current thread; outside callers share the last one
+//
+static thread_local int workerIndex = -1;
+static thread_local TaskPool *workerPool = nullptr;
+
+TaskPool::TaskPool(int numThreads) {
+	if (numThreads <= 0) numThreads = defaultThreads();
+	pending = 0;
+	queued = 0;
+	bStop = false;
+	for (int i = 0; i < numThreads + 1; i++) {
+		queues.push_back(unique_ptr<Queue>(new Queue()));
+	}
+	for (int i = 0; i < numThreads; i++) {
+		workers.push_back(std::thread(&TaskPool::workerLoop, this, i));
+	}
+}
+
+TaskPool::~TaskPool() {
+	{
+		std::lock_guard<std::mutex> guard(sleepLock);
+		bStop = true;
+	}
+	wakeup.notify_all();
+	for (unsigned int i = 0; i < workers.size(); i++) {
+		workers[i].join();
+	}
+}
+
+int TaskPool::defaultThreads() {
+	int n = std::thread::hardware_concurrency();
+	return n > 0 ? n : 1;
+}
+
+//  queue a task on the calling thread's deque and wake an idle worker
+//
+void TaskPool::run(const std::function<void()> & task) {
+	int id = workerPool == this ? workerIndex : queues.size() - 1;
+	pending++;
+	{
+		std::lock_guard<std::mutex> guard(queues[id]->lock);
+		queues[id]->tasks.push_back(task);
+	}
+	queued++;
+	{
+		std::lock_guard<std::mutex> guard(sleepLock);
+	}
+	wakeup.notify_one();
+}
+
+//  take the newest task from our own deque, otherwise steal the oldest task
+//  from somebody else's
+//
+bool TaskPool::popTask(int id, std::function<void()> & task) {
+	{
+		Queue & own = *queues[id];
+		std::lock_guard<std::mutex> guard(own.lock);
+		if (!own.tasks.empty()) {
+			task = std::move(own.tasks.back());
+			own.tasks.pop_back();
+			queued--;
+			return true;
+		}
+	}
+	for (unsigned int i = 1; i < queues.size(); i++) {
+		Queue & victim = *queues[(id + i) % queues.size()];
+		std::lock_guard<std::mutex> guard(victim.lock);
+		if (!victim.tasks.empty()) {
+			task = std::move(victim.tasks.front());
+			victim.tasks.pop_front();
+			queued--;
+			return true;
+		}
+	}
+	return false;
+}
+
+void TaskPool::execute(std::function<void()> & task) {
+	task();
+	task = nullptr;
+	if (--pending == 0) {
+		std::lock_guard<std::mutex> guard(sleepLock);
+		done.notify_all();
+	}
+}
+
+void TaskPool::workerLoop(int id) {
+	workerIndex = id;
+	workerPool = this;
+	std::function<void()> task;
+	while (true) {
+		if (popTask(id, task)) {
+			execute(task);
+			continue;
+		}
+		std::unique_lock<std::mutex> guard(sleepLock);
+		if (bStop) return;
+		if (queued > 0) continue;		// a task was queued since we looked, go get it
+		wakeup.wait(guard);
+	}
+}
+
+//  run tasks on the calling thread until everything queued so far has finished
+//
+void TaskPool::wait() {
+	int id = workerPool == this ? workerIndex : queues.size() - 1;
+	std::function<void()> task;
+	while (pending > 0) {
+		if (popTask(id, task)) {
+			execute(task);
+			continue;
+		}
+		std::unique_lock<std::mutex> guard(sleepLock);
+		if (pending > 0) done.wait_for(guard, std::chrono::milliseconds(1));
+	}
+}
@@ -0,0 +1,45 @@
+#pragma once
+#include "ofMain.h"
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <deque>
+
+//  Small work-stealing task pool.  Every worker owns a deque of tasks; it
+//  pops its own work from the back and steals from the front of the other
+//  workers' deques when it runs dry.  Tasks submitted from inside a task go
+//  to the submitting worker's deque, so recursive work (like octree subtrees)
+//  stays local until somebody else is idle.
+//
+class TaskPool {
+public:
+	TaskPool(int numThreads = 0);		// 0 = one worker per hardware thread
+	~TaskPool();
+
+	void run(const std::function<void()> & task);
+	void wait();						// block until all tasks are done; the caller helps out
+	int size() const { return workers.size(); }
+
+	static int defaultThreads();
+
+private:
+	struct Queue {
+		std::mutex lock;
+		std::deque<std::function<void()>> tasks;
+	};
+
+	void workerLoop(int id);
+	bool popTask(int id, std::function<void()> & task);
+	void execute(std::function<void()> & task);
+
+	vector<unique_ptr<Queue>> queues;	// one per worker plus one for outside callers
+	vector<std::thread> workers;
+	std::atomic<int> pending;			// tasks queued or running
+	std::atomic<int> queued;			// tasks sitting in a deque
+	std::mutex sleepLock;
+	std::condition_variable wakeup;
+	std::condition_variable done;
+	bool bStop;
+};
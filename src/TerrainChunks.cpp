@@ -0,0 +1,350 @@
+#include "TerrainChunks.h"
+#include <unordered_map>
+
+// build the chunks of "octree" and wait for them
+//
+void TerrainChunks::setup(const Octree & octree, int level, int lodAt) {
+	begin(octree, level, lodAt);
+	end();
+}
+
+// begin:  copy the top of the octree breadth first, so the children of every
+//         node stay contiguous, fill the index buffer leaf by leaf at the
+//         leaves' own places in the octree's index array, and leave the
+//         simplification to the worker.  A build still running is finished
+//         first.
+//
+void TerrainChunks::begin(const Octree & octree, int level, int lodAt) {
+	end();
+	chunkLevel = level;
+	lodLevel = lodAt;
+	if (octree.nodes.size() == 0 || octree.primitives != TrianglePrimitives) {
+		printf("Terrain chunks need a flat triangle octree\n");
+		nodes.clear();
+		ranges.clear();
+		revision = octree.revision;
+		numChunks = 0;
+		return;
+	}
+
+	Build & b = next;
+	b.started = ofGetElapsedTimeMicros();
+	b.revision = octree.revision;
+	const ofMesh & mesh = octree.mesh;
+	b.triangles.resize(octree.nodes[0].numPoints * 3);
+	for (int i = 0; i < (int)octree.nodes.size(); i++) {
+		const FlatNode & n = octree.nodes[i];
+		if (n.numChildren != 0) continue;
+		for (int p = n.firstPoint; p < n.firstPoint + n.numPoints; p++) {
+			int t = octree.point(n.firstChild, p);
+			for (int c = 0; c < 3; c++) b.triangles[3 * p + c] = mesh.getIndex(3 * t + c);
+		}
+	}
+
+	// a node is a LOD node if it is the first on its path at lodLevel or
+	// deeper, or a chunk none of whose ancestors is one
+	//
+	vector<ChunkNode> & chunks = b.nodes;
+	vector<int> source;			// octree node of every chunk node
+	vector<char> belowLod;		// an ancestor is a LOD node
+	chunks.clear();
+	chunks.push_back(ChunkNode());
+	source.push_back(0);
+	belowLod.push_back(0);
+	for (int i = 0; i < (int)chunks.size(); i++) {
+		const FlatNode & n = octree.nodes[source[i]];
+		ChunkNode & node = chunks[i];
+		node.box = n.box;
+		node.firstIndex = 3 * n.firstPoint;
+		node.numIndices = 3 * n.numPoints;
+		node.numChildren = 0;
+		node.firstChild = 0;
+		bool bChunk = n.numChildren <= 0 || n.level >= chunkLevel;
+		node.numLods = !belowLod[i] && (n.level >= lodLevel || bChunk) ? 1 : 0;
+		node.lodFirst[0] = node.firstIndex;
+		node.lodCount[0] = node.numIndices;
+		node.lodError[0] = 0;
+		if (!bChunk) {
+			char below = belowLod[i] || node.numLods > 0;
+			chunks[i].firstChild = chunks.size();
+			chunks[i].numChildren = n.numChildren;
+			for (int c = 0; c < n.numChildren; c++) {
+				chunks.push_back(ChunkNode());
+				source.push_back(n.firstChild + c);
+				belowLod.push_back(below);
+			}
+		}
+	}
+	for (int i = chunks.size() - 1; i >= 0; i--) {
+		ChunkNode & node = chunks[i];
+		node.numChunks = node.numChildren == 0 ? 1 : 0;
+		node.lodsBelow = false;
+		for (int c = node.firstChild; c < node.firstChild + node.numChildren; c++) {
+			node.numChunks += chunks[c].numChunks;
+			node.lodsBelow = node.lodsBelow || chunks[c].numLods > 0 || chunks[c].lodsBelow;
+		}
+	}
+
+	b.vertices = mesh.getVertices();
+	b.normals = mesh.getNormals();
+	b.texCoords = mesh.getTexCoords();
+	if (!pool) pool.reset(new TaskPool(1));
+	bBuilding = true;
+	bBuilt = false;
+	pool->run([this]() {
+		buildLods(next);
+		next.finished = ofGetElapsedTimeMicros();
+		bBuilt = true;
+	});
+}
+
+// swap the running build in if the worker is done, without waiting
+//
+bool TerrainChunks::poll() {
+	if (!bBuilding || !bBuilt) return false;
+	end();
+	return true;
+}
+
+// wait for the running build and swap it in
+//
+void TerrainChunks::end() {
+	if (!bBuilding) return;
+	pool->wait();
+	bBuilding = false;
+
+	nodes.swap(next.nodes);
+	ranges.clear();
+	revision = next.revision;
+	numChunks = nodes[0].numChunks;
+	buildMs = (next.finished - next.started) / 1000.0;
+
+	const Build & b = next;
+	vbo.clear();
+	vbo.setVertexData(b.vertices.data(), b.vertices.size(), GL_STATIC_DRAW);
+	if (b.normals.size() == b.vertices.size()) vbo.setNormalData(b.normals.data(), b.normals.size(), GL_STATIC_DRAW);
+	if (b.texCoords.size() == b.vertices.size()) vbo.setTexCoordData(b.texCoords.data(), b.texCoords.size(), GL_STATIC_DRAW);
+	vbo.setIndexData(b.triangles.data(), b.triangles.size(), GL_STATIC_DRAW);
+	next = Build();
+}
+
+// cell of a clustering grid of cells "size" wide
+//
+static uint64_t cellKey(const glm::vec3 & p, const glm::vec3 & origin, float size) {
+	uint64_t x = (uint64_t)((p.x - origin.x) / size) & 0x1fffff;
+	uint64_t y = (uint64_t)((p.y - origin.y) / size) & 0x1fffff;
+	uint64_t z = (uint64_t)((p.z - origin.z) / size) & 0x1fffff;
+	return x | (y << 21) | (z << 42);
+}
+
+// buildLods:  the simplified versions of every LOD node of a build, made on
+//             the worker thread.  Each cluster of free vertices becomes one
+//             new vertex at their mean (normals and texture coordinates
+//             averaged too), appended after the mesh's; the new triangles go
+//             after the full detail ones.  A version that saves less than a
+//             quarter of the triangles of the one before ends the node's
+//             list.
+//
+void TerrainChunks::buildLods(Build & build) {
+	vector<ChunkNode> & nodes = build.nodes;
+	vector<ofIndexType> & triangles = build.triangles;
+	vector<glm::vec3> & vertices = build.vertices;
+	vector<glm::vec3> & normals = build.normals;
+	vector<glm::vec2> & texCoords = build.texCoords;
+	int numTriangles = triangles.size() / 3;
+	if (numTriangles == 0) return;
+	bool bNormals = normals.size() == vertices.size();
+	bool bTexCoords = texCoords.size() == vertices.size();
+
+	// the vertices at positions used by more than one LOD node.  Positions
+	// are compared quantized to 1/1024 of the mean edge, not by index: the
+	// mesh is not welded, so both sides of a texture seam have their own
+	// copies of the vertices along it.  A key that wraps around only locks
+	// more than it needs to.
+	//
+	vector<int> lodNodes;
+	for (int i = 0; i < (int)nodes.size(); i++) {
+		if (nodes[i].numLods > 0) lodNodes.push_back(i);
+	}
+	double edges = 0;
+	for (int l : lodNodes) {
+		const ChunkNode & node = nodes[l];
+		for (int i = node.firstIndex; i < node.firstIndex + node.numIndices; i++) {
+			edges += glm::length(vertices[triangles[i]] - vertices[triangles[i % 3 == 2 ? i - 2 : i + 1]]);
+		}
+	}
+	float edge = edges / triangles.size();
+	Vector3 lo = nodes[0].box.min();
+	glm::vec3 origin(lo.x(), lo.y(), lo.z());
+	float quantum = edge / 1024;
+
+	unordered_map<uint64_t, int> positionOwner;		// LOD node using a position, -1 for several
+	for (int l : lodNodes) {
+		const ChunkNode & node = nodes[l];
+		for (int i = node.firstIndex; i < node.firstIndex + node.numIndices; i++) {
+			auto found = positionOwner.emplace(cellKey(vertices[triangles[i]], origin, quantum), l);
+			if (!found.second && found.first->second != l) found.first->second = -1;
+		}
+	}
+	vector<char> locked(vertices.size(), 0);
+	for (int l : lodNodes) {
+		const ChunkNode & node = nodes[l];
+		for (int i = node.firstIndex; i < node.firstIndex + node.numIndices; i++) {
+			int v = triangles[i];
+			locked[v] = positionOwner[cellKey(vertices[v], origin, quantum)] < 0;
+		}
+	}
+
+	unordered_map<uint64_t, int> clusters;
+	vector<int> clusterOf(vertices.size(), -1);
+	vector<int> count;
+	for (int l : lodNodes) {
+		ChunkNode & node = nodes[l];
+		for (int level = 1; level < maxLods; level++) {
+			float size = edge * (1 << level);
+			int base = vertices.size();
+			clusters.clear();
+			count.clear();
+			for (int i = node.firstIndex; i < node.firstIndex + node.numIndices; i++) {
+				int v = triangles[i];
+				if (locked[v] || clusterOf[v] >= 0) continue;
+				auto found = clusters.emplace(cellKey(vertices[v], origin, size), (int)count.size());
+				int c = found.first->second;
+				if (found.second) {
+					count.push_back(0);
+					vertices.push_back(glm::vec3(0));
+					if (bNormals) normals.push_back(glm::vec3(0));
+					if (bTexCoords) texCoords.push_back(glm::vec2(0, 0));
+				}
+				clusterOf[v] = c;
+				count[c]++;
+				vertices[base + c] += vertices[v];
+				if (bNormals) normals[base + c] += normals[v];
+				if (bTexCoords) texCoords[base + c] += texCoords[v];
+			}
+			for (int c = 0; c < (int)count.size(); c++) {
+				vertices[base + c] /= (float)count[c];
+				if (bNormals) normals[base + c] = glm::normalize(normals[base + c]);
+				if (bTexCoords) texCoords[base + c] /= (float)count[c];
+			}
+
+			int first = triangles.size();
+			float error = 0;
+			for (int i = node.firstIndex; i < node.firstIndex + node.numIndices; i += 3) {
+				int corner[3];
+				for (int k = 0; k < 3; k++) {
+					int v = triangles[i + k];
+					corner[k] = locked[v] ? v : base + clusterOf[v];
+					if (!locked[v]) error = std::max(error, glm::length(vertices[v] - vertices[corner[k]]));
+				}
+				if (corner[0] == corner[1] || corner[1] == corner[2] || corner[0] == corner[2]) continue;
+				for (int k = 0; k < 3; k++) triangles.push_back(corner[k]);
+			}
+			for (int i = node.firstIndex; i < node.firstIndex + node.numIndices; i++) clusterOf[triangles[i]] = -1;
+
+			int numIndices = triangles.size() - first;
+			if (numIndices * 4 > node.lodCount[node.numLods - 1] * 3) {
+				triangles.resize(first);
+				vertices.resize(base);
+				if (bNormals) normals.resize(base);
+				if (bTexCoords) texCoords.resize(base);
+				break;
+			}
+			node.lodFirst[node.numLods] = first;
+			node.lodCount[node.numLods] = numIndices;
+			node.lodError[node.numLods] = error;
+			node.numLods++;
+		}
+	}
+}
+
+// The frustum planes come straight from the rows of the view projection
+// matrix (Gribb and Hartmann), inside where a * x + b * y + c * z + d >= 0.
+//
+void TerrainChunks::draw(const ofCamera & camera) {
+	visibleChunks = 0;
+	visibleTriangles = 0;
+	drawCalls = 0;
+	if (nodes.empty()) return;
+
+	uint64_t start = ofGetElapsedTimeMicros();
+	glm::mat4 m = camera.getModelViewProjectionMatrix();
+	glm::vec4 row[4];
+	for (int i = 0; i < 4; i++) row[i] = glm::vec4(m[0][i], m[1][i], m[2][i], m[3][i]);
+	glm::vec4 planes[6] = { row[3] + row[0], row[3] - row[0], row[3] + row[1], row[3] - row[1], row[3] + row[2], row[3] - row[2] };
+	eye = camera.getPosition();
+	pixelsPerRadian = ofGetHeight() / (2 * tan(ofDegToRad(camera.getFov()) / 2));
+	for (int l = 0; l < maxLods; l++) lodNodes[l] = 0;
+	ranges.clear();
+	cull(0, planes, 0x3f);
+	cullUs = ofGetElapsedTimeMicros() - start;
+
+	for (int i = 0; i < (int)ranges.size(); i += 2) {
+		vbo.drawElements(GL_TRIANGLES, ranges[i + 1], ranges[i]);
+		visibleTriangles += ranges[i + 1] / 3;
+		drawCalls++;
+	}
+}
+
+// cull:  test the box against the planes in "planeMask" (the ones its parent
+//        was not wholly inside of).  Of every plane the box corner furthest
+//        along the plane's normal decides if it is outside, the nearest one
+//        if it is inside.
+//
+void TerrainChunks::cull(int node, const glm::vec4 planes[6], int planeMask) {
+	const ChunkNode & n = nodes[node];
+	const Vector3 & lo = n.box.parameters[0];
+	const Vector3 & hi = n.box.parameters[1];
+	for (int i = 0; i < 6; i++) {
+		if (!(planeMask & (1 << i))) continue;
+		const glm::vec4 & p = planes[i];
+		float farthest = p.w + p.x * (p.x > 0 ? hi.x() : lo.x()) + p.y * (p.y > 0 ? hi.y() : lo.y()) + p.z * (p.z > 0 ? hi.z() : lo.z());
+		if (farthest < 0) return;
+		float nearest = p.w + p.x * (p.x > 0 ? lo.x() : hi.x()) + p.y * (p.y > 0 ? lo.y() : hi.y()) + p.z * (p.z > 0 ? lo.z() : hi.z());
+		if (nearest >= 0) planeMask &= ~(1 << i);
+	}
+	if (n.numLods > 0) {
+		int lod = selectLod(n);
+		lodNodes[lod]++;
+		if (lod > 0) {
+			visibleChunks += n.numChunks;
+			addRange(n.lodFirst[lod], n.lodCount[lod]);
+			return;
+		}
+	}
+	if (n.numChildren > 0 && (planeMask != 0 || (bLod && n.lodsBelow))) {
+		for (int c = n.firstChild; c < n.firstChild + n.numChildren; c++) cull(c, planes, planeMask);
+		return;
+	}
+	visibleChunks += n.numChunks;
+	addRange(n.firstIndex, n.numIndices);
+}
+
+// selectLod:  the coarsest version of a LOD node whose error, seen from
+//             the nearest point of its box, is within pixelError
+//
+int TerrainChunks::selectLod(const ChunkNode & node) const {
+	if (!bLod) return 0;
+	const Vector3 & lo = node.box.parameters[0];
+	const Vector3 & hi = node.box.parameters[1];
+	glm::vec3 nearest(ofClamp(eye.x, lo.x(), hi.x()), ofClamp(eye.y, lo.y(), hi.y()), ofClamp(eye.z, lo.z(), hi.z()));
+	float distance = glm::length(eye - nearest);
+	int lod = 0;
+	for (int l = 1; l < node.numLods; l++) {
+		if (node.lodError[l] * pixelsPerRadian > pixelError * distance) break;
+		lod = l;
+	}
+	return lod;
+}
+
+// addRange:  queue a range for drawing, merged with the last one if they meet
+//
+void TerrainChunks::addRange(int first, int count) {
+	if (count == 0) return;
+	int last = ranges.size() - 2;
+	if (last >= 0 && ranges[last] + ranges[last + 1] == first) ranges[last + 1] += count;
+	else {
+		ranges.push_back(first);
+		ranges.push_back(count);
+	}
+}
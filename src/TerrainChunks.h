@@ -0,0 +1,112 @@
+#pragma once
+#include "ofMain.h"
+#include "Octree.h"
+#include "TaskPool.h"
+#include <atomic>
+
+//  Terrain drawn in chunks that follow a triangle octree.  setup() copies
+//  the octree's nodes down to chunkLevel (a leaf above it is a chunk too)
+//  and lays the triangles out in one index buffer in tree order, so every
+//  node, chunk or not, owns one contiguous range of it.  draw() culls that
+//  hierarchy against the camera's view frustum: a node outside a plane is
+//  dropped with its subtree, one inside all the planes still in question is
+//  drawn whole without testing its children, and only nodes the frustum
+//  cuts are opened.  Neighboring visible ranges are merged, so a frame
+//  costs a few draw calls.
+//
+//  Level of detail: the nodes at lodLevel (or leaves above it) also get
+//  simplified versions of their triangles, made by clustering vertices in
+//  grid cells 2, 4, 8 ... times the mean edge length and dropping the
+//  triangles that collapse.  Vertices at positions another LOD node also
+//  uses are never moved, so neighbors at any levels meet on the same edges
+//  and no cracks open, seams with duplicated vertices included.  Each
+//  version keeps the largest distance a vertex was moved, and draw() picks
+//  the coarsest version whose error, projected from the nearest point of
+//  the node's box, stays within pixelError pixels; only nodes drawn at full
+//  detail are culled further down.
+//
+//  The chunks copy the mesh and the node boxes; revision is the octree
+//  revision they were built from, so build them again when it changes.
+//  setup() builds them on the spot.  begin() only copies what it needs from
+//  the octree and simplifies on a worker thread; poll() swaps the new chunks
+//  in once they are done (end() waits for them), and until then draw() keeps
+//  drawing the old ones, so a crater does not stall the frame.  The octree
+//  is free to change while a build runs.
+//
+class TerrainChunks {
+public:
+	~TerrainChunks() { if (pool) pool->wait(); }
+
+	void setup(const Octree & octree, int chunkLevel, int lodLevel = 3);
+	void begin(const Octree & octree, int chunkLevel, int lodLevel = 3);
+	void end();
+	bool poll();
+	bool busy() const { return bBuilding; }
+	void draw(const ofCamera & camera);
+	bool ready() const { return !nodes.empty(); }
+
+	int chunkLevel = 5;
+	int lodLevel = 3;
+	bool bLod = true;
+	float pixelError = 1.5;
+	int revision = -1;
+	static const int maxLods = 4;		// full detail and three simplified versions
+
+	// what the last draw() drew, and the time culling took.  lodNodes counts
+	// the LOD nodes drawn at each level.  buildMs runs from begin() until
+	// the worker was done.
+	//
+	int numChunks = 0;
+	int visibleChunks = 0;
+	int visibleTriangles = 0;
+	int drawCalls = 0;
+	int lodNodes[maxLods] = {};
+	float cullUs = 0;
+	float buildMs = 0;
+
+private:
+	class ChunkNode {
+	public:
+		Box box;
+		int firstChild;
+		int numChildren;		// 0 for a chunk
+		int firstIndex;			// range of the index buffer
+		int numIndices;
+		int numChunks;			// chunks in the subtree
+		bool lodsBelow;			// LOD nodes in the subtree, below this one
+		int numLods;			// versions of a LOD node (the first is the range above), 0 elsewhere
+		int lodFirst[maxLods];
+		int lodCount[maxLods];
+		float lodError[maxLods];
+	};
+	// chunks being built: the copies begin() takes, filled in by the worker
+	//
+	class Build {
+	public:
+		vector<ChunkNode> nodes;
+		vector<ofIndexType> triangles;
+		vector<glm::vec3> vertices;
+		vector<glm::vec3> normals;
+		vector<glm::vec2> texCoords;
+		int revision = -1;
+		uint64_t started = 0;
+		uint64_t finished = 0;
+	};
+	void cull(int node, const glm::vec4 planes[6], int planeMask);
+	int selectLod(const ChunkNode & node) const;
+	void addRange(int first, int count);
+	static void buildLods(Build & build);
+
+	vector<ChunkNode> nodes;
+	vector<int> ranges;			// visible (first index, count) pairs
+	ofVbo vbo;
+
+	Build next;
+	bool bBuilding = false;
+	std::atomic<bool> bBuilt{ false };
+	unique_ptr<TaskPool> pool;
+
+	// camera of the draw in progress: eye and pixels per unit of tangent
+	glm::vec3 eye;
+	float pixelsPerRadian = 0;
+};
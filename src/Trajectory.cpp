@@ -0,0 +1,21 @@
+#include "Trajectory.h"
+
+ofVec3f Trajectory::at(float t) const {
+	if (drag <= 0) return position + velocity * t + acceleration * (0.5f * t * t);
+	ofVec3f terminal = acceleration / drag;
+	return position + terminal * t + (velocity - terminal) * ((1 - exp(-drag * t)) / drag);
+}
+
+ofVec3f Trajectory::velocityAt(float t) const {
+	if (drag <= 0) return velocity + acceleration * t;
+	ofVec3f terminal = acceleration / drag;
+	return terminal + (velocity - terminal) * exp(-drag * t);
+}
+
+// the second derivative, acceleration - drag * v, only shrinks along the
+// path (it decays as exp(-drag * t)), so its size at t bounds the piece
+//
+float Trajectory::chordError(float t, float h) const {
+	ofVec3f curve = acceleration - velocityAt(t) * drag;
+	return h * h / 8 * curve.length();
+}
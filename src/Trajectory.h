@@ -0,0 +1,38 @@
+#pragma once
+#include "ofMain.h"
+
+//  Path of a body under a constant acceleration (gravity plus thrust, per
+//  unit mass) and linear drag: dv/dt = acceleration - drag * v.  The drag
+//  stands in for the particle integrator's per frame velocity damping,
+//  -log(damping) * frame rate; 0 gives a plain ballistic arc.
+//
+//  chordError() bounds how far the path strays from the straight line
+//  between its positions at t and t + h (h^2 / 8 times the largest
+//  curvature acceleration on the way), so a capsule of that radius around
+//  the chord holds that piece of the path.
+//
+class Trajectory {
+public:
+	ofVec3f at(float t) const;
+	ofVec3f velocityAt(float t) const;
+	float chordError(float t, float h) const;
+
+	ofVec3f position;
+	ofVec3f velocity;
+	ofVec3f acceleration;
+	float drag = 0;
+};
+
+//  Where a trajectory first meets the terrain.  point is the body's center
+//  at impact, normal the surface normal there and slope its angle from the
+//  horizontal in degrees; sweeps counts the index queries it took.
+//
+class TrajectoryHit {
+public:
+	ofVec3f point;
+	ofVec3f normal;
+	ofVec3f velocity;
+	float time = 0;
+	float slope = 0;
+	int sweeps = 0;
+};
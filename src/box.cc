@@ -13,6 +13,11 @@
  */
 
 bool Box::intersect(const Ray &r, float t0, float t1) const {
+  float tEntry;
+  return intersect(r, t0, t1, tEntry);
+}
+
+bool Box::intersect(const Ray &r, float t0, float t1, float &tEntry) const {
   float tmin, tmax, tymin, tymax, tzmin, tzmax;
 
   tmin = (parameters[r.sign[0]].x() - r.origin.x()) * r.inv_direction.x();
@@ -33,5 +38,6 @@ bool Box::intersect(const Ray &r, float t0, float t1) const {
     tmin = tzmin;
   if (tzmax < tmax)
     tmax = tzmax;
+  tEntry = tmin > t0 ? tmin : t0;
   return ( (tmin < t1) && (tmax > t0) );
 }
@@ -1,5 +1,6 @@
 #include "ofApp.h"
 #include "Util.h"
+#include "Box8.h"
 
 /*
 
@@ -9,6 +10,9 @@ Keybinds:
 	F3 is the bottom cam
 	F4 is the front cam
 	
+	b runs the octree and spatial index benchmarks (results printed to the console)
+	L toggles the lidar scan from the lander
+
 	Up arrow is for forward
 	Down arrow is for backward
 	Right arrow is for going right
@@ -83,11 +87,35 @@ void ofApp::setup(){
 	//if (mars.loadModel("geo/mars-low-v2.obj")) {							//PLAN B; DEFAULT TERRAIN
 		mars.setRotation(0, 180, 0, 0, 1);
 		mars.setScaleNormalization(false);
-		printf("Map loaded, creating octree...\n");
+		printf("Map loaded, creating %s...\n", bUseBVH ? "bvh" : "octree");
 
 		float time = ofGetElapsedTimef();
-		octree.create(mars.getMesh(0), levels);
-		printf("Setup complete in %.0fms\n", (ofGetElapsedTimef() - time) * 1000);
+		if (bUseBVH) {
+			bvh.create(mars.getMesh(0));
+			terrainIndex = &bvh;
+			printf("Setup complete in %.0fms (bvh built)\n", (ofGetElapsedTimef() - time) * 1000);
+			printf("BVH: %d nodes, depth %d, %.2f MB\n", bvh.numNodes(), bvh.depth(), bvh.memoryUsage() / (1024.0 * 1024.0));
+		}
+		else {
+			octree.numThreads = 0;		// build on every core
+			octree.primitives = TrianglePrimitives;
+			octreeParams.maxLevels = levels;
+			bool bCached = octree.createCached(mars.getMesh(0), octreeParams, ofToDataPath("geo/Lunar_Lander_mars_terrain_model.octree"));
+			terrainIndex = &octree;
+			printf("Setup complete in %.0fms (%s)\n", (ofGetElapsedTimef() - time) * 1000, bCached ? "octree loaded from cache" : "octree built");
+			OctreeBuildStats stats = octree.statistics();
+			printf("Octree: %d nodes, %d leaves (%.1f triangles each, %d at most), depth %d, %.2f MB (%s layout)\n", stats.numNodes,
+				stats.numLeaves, stats.meanLeafPoints, stats.maxLeafPoints, stats.depth, stats.memory / (1024.0 * 1024.0), octree.bLinear ? "flat" : "pointer");
+			printf("Octree: %.1f bytes per node, %.1f bytes per triangle%s\n", stats.bytesPerNode, stats.bytesPerTriangle, stats.compact ? " (16 bit leaves)" : "");
+		}
+
+		terrainTexture = mars.getTextureForMesh(0);
+		terrainMaterial = mars.getMaterialForMesh(0);
+
+		time = ofGetElapsedTimef();
+		heightField.create(mars.getMesh(0), heightFieldResolution);
+		printf("Heightfield: %d x %d in %.0fms, %.2f MB, %d samples left to the %s\n", heightField.cols, heightField.rows,
+			(ofGetElapsedTimef() - time) * 1000, heightField.memoryUsage() / (1024.0 * 1024.0), heightField.numFlagged(), bUseBVH ? "bvh" : "octree");
 	}
 	else {
 		printf("Map could not be loaded.\n");
@@ -100,6 +128,7 @@ void ofApp::setup(){
 		rover.setPosition(0, 5, 0);
 
 		bRoverLoaded = true;
+		buildLanderTree();
 
 		cout << "Vehicle loaded at position: " << rover.getPosition() << endl;
 	}
@@ -190,11 +219,27 @@ void ofApp::setup(){
 	dynamicLight.rotate(180, ofVec3f(0, 1, 0));
 	dynamicLight.setPosition((ofVec3f) (rover.getPosition(), rover.getPosition() + 10, rover.getPosition()));
 	dynamicLight.rotate(90, ofVec3f(1, 0, 0));
+
 	cout << "Setup complete." << endl;
 }
 
 //--------------------------------------------------------------
 void ofApp::update(){
+	//Picks up the lidar scan if it is done; until then the last finished one
+	//stays up and no new one starts
+	lidar.poll();
+
+	//Swaps in the terrain chunks rebuilt after a crater once they are done;
+	//until then the old ones are drawn
+	terrainChunks.poll();
+
+	//Frame time and terrain load for comparing the terrain with and without LOD ('K')
+	if (bTerrainChunks && terrainChunks.ready()) {
+		lodFrames++;
+		lodFrameSeconds += ofGetLastFrameTime();
+		lodTriangles += terrainChunks.visibleTriangles;
+	}
+
 	//Checks if space was hit before starting game
 	if (bStart) {
 		//Updates rover model and thrust emitter position to coincide with vehicle particle
@@ -202,12 +247,24 @@ void ofApp::update(){
 		rover.setPosition(vehicle->position.x, vehicle->position.y, vehicle->position.z);
 		emitter->setPosition(ofVec3f(vehicle->position.x, vehicle->position.y, vehicle->position.z));
 
-		Ray altRay = Ray(Vector3(vehicle->position.x, vehicle->position.y, vehicle->position.z), 
-			Vector3(vehicle->position.x, vehicle->position.y - 200, vehicle->position.z));
-		TreeNode altNode;
-		if (octree.intersect(altRay, octree.root, altNode)) {
-			altitude = glm::length(octree.mesh.getVertex(altNode.points[0]) - glm::vec3(vehicle->position));
+		//Terrain straight below the lander: a heightfield lookup, or an exact ray
+		//down the terrain index where the heightfield cannot answer (overhangs)
+		float groundHeight;
+		ofVec3f groundNormal;
+		bGroundFromHeightField = heightField.ground(vehicle->position.x, vehicle->position.z, groundHeight, groundNormal);
+		if (bGroundFromHeightField) {
+			bGroundHit = true;
+			groundHit.point = ofVec3f(vehicle->position.x, groundHeight, vehicle->position.z);
+			groundHit.normal = groundNormal;
+			groundHit.distance = vehicle->position.y - groundHeight;
+			groundHit.triangle = -1;
+			groundHit.node = -1;
+		}
+		else {
+			Ray altRay = Ray(Vector3(vehicle->position.x, vehicle->position.y, vehicle->position.z), Vector3(0, -1, 0));
+			bGroundHit = terrainIndex->intersect(altRay, groundHit);
 		}
+		if (bGroundHit) altitude = groundHit.distance;
 
 		//Checks if there is a collision with the ground and then counteracts down force to stop lander
 		//After that it will wait until lander is slowed to a point and then brute forces a full stop
@@ -259,9 +316,14 @@ void ofApp::update(){
 		//Makes sure the bg sound is playing at all times when game is started
 		if (!martianWind.isPlaying()) martianWind.play();
 
-		//Moves the vehicle and updates vehicle managing system
+		//Moves the vehicle and updates vehicle managing system.  The step is swept
+		//against the terrain so a large step cannot carry the lander through it
 		vehicleMove();
+		ofVec3f lastPosition = vehicle->position;
 		vehicleSys->update();
+		sweepVehicle(lastPosition);
+		predictImpact();
+		if (bLidar && !lidar.busy()) lidar.begin(*terrainIndex, vehicle->position);
 		emitter->update();
 		// to follow the rover position
 		dynamicLight.setPosition((ofVec3f)(rover.getPosition(), rover.getPosition() + 10, rover.getPosition()));
@@ -321,20 +383,75 @@ void ofApp::update(){
 	}
 }
 
+// Draws the terrain as chunks of the octree culled to the current camera,
+// rebuilt in the background whenever the octree changed (craters), with the
+// model's material and texture.  The bvh, the chunks switched off, or no
+// chunks built yet draw the whole mesh.
+// The octree's copy of the mesh carries the craters.
+//
+void ofApp::drawTerrain(bool bLines) {
+	if (bTerrainChunks && terrainIndex == &octree) {
+		if (terrainChunks.revision != octree.revision && !terrainChunks.busy()) terrainChunks.begin(octree, terrainChunkLevel, terrainLodLevel);
+		if (terrainChunks.ready()) {
+			if (bLines) {
+				glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
+				terrainChunks.draw(*currentCam);
+				glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+				return;
+			}
+			terrainMaterial.begin();
+			if (terrainTexture.isAllocated()) terrainTexture.bind();
+			terrainChunks.draw(*currentCam);
+			if (terrainTexture.isAllocated()) terrainTexture.unbind();
+			terrainMaterial.end();
+			return;
+		}
+	}
+	if (bLines) {
+		if (numCraters > 0) octree.mesh.drawWireframe();
+		else mars.drawWireframe();
+	}
+	else {
+		if (numCraters > 0) octree.mesh.drawFaces();
+		else mars.drawFaces();
+	}
+}
+
 // Handles collision detection
 //-Aaron Warren
 void ofApp::checkCollisions() {
-	TreeNode intersectedNode;
-
-	//Checks if the vehicle particle intersects any point in the octree
-	if (octree.intersect(vehicle->position, octree.root, intersectedNode)) {
+	NodeRef contact;
+
+	//Checks if the vehicle particle is on or under the ground; without a
+	//heightfield sample, whether it is inside a leaf of the terrain index
+	bool bContact = bGroundFromHeightField ? altitude <= 0 : terrainIndex->intersect(vehicle->position, landerCursor, contact);
+
+	//With the octree the lander's own mesh is tested against the terrain mesh
+	//as well, so a leg touching a slope counts and not only the center point
+	bool bMeshContact = false;
+	if (terrainIndex == &octree && bRoverLoaded) {
+		uint64_t start = ofGetElapsedTimeMicros();
+		bMeshContact = octree.collide(landerTree, rover.getModelMatrix(), landerContacts) > 0;
+		landerContactUs = ofGetElapsedTimeMicros() - start;
+	}
+	if (bContact || bSweptContact || bMeshContact) {
 		//If it does then the lander can only move up
 		bGrounded = true;
 		//Removes turbulence and gravity
 		tForce->set(ofVec3f(0, 0, 0), ofVec3f(0, 0, 0));
 		gForce->set(ofVec3f(0, 0, 0));
 		//Counteracts current velocity to stop it from moving entirely
-		ofVec3f normal = octree.mesh.getNormal(intersectedNode.points.at(0));
+		//using the face normal of the terrain under the lander
+		ofVec3f normal = bSweptContact ? sweptHit.normal : (bGroundHit ? groundHit.normal : ofVec3f(0, 1, 0));
+		if (bMeshContact) {
+			//Backs the lander out of the terrain along the deepest contact
+			const MeshContact * deepest = &landerContacts[0];
+			for (const MeshContact & c : landerContacts) {
+				if (c.depth > deepest->depth) deepest = &c;
+			}
+			vehicle->position += deepest->normal * deepest->depth;
+			normal = deepest->normal;
+		}
 		ofVec3f vec = ofGetFrameRate() * -1 * vehicle->velocity;
 		ofVec3f force = 1.6 * (vec.dot(normal) * normal);
 		iForce->set(force);
@@ -347,6 +464,119 @@ void ofApp::checkCollisions() {
 	}
 }
 
+// Continuous collision for the last integration step: sweeps the lander
+// (a sphere of landerRadius, or a point) from where it was to where the
+// integrator put it.  On contact the lander is put back at the time of impact
+// and loses the part of its velocity that points into the surface, so any
+// step size is safe and the next checkCollisions() sees the contact.  A hard
+// impact leaves a crater.
+//
+void ofApp::sweepVehicle(const ofVec3f & lastPosition) {
+	bSweptContact = terrainIndex->sweep(lastPosition, vehicle->position, landerRadius, sweptHit);
+	if (!bSweptContact) return;
+
+	vehicle->position = sweptHit.point;
+	float into = vehicle->velocity.dot(sweptHit.normal);
+	if (into < 0) vehicle->velocity -= into * sweptHit.normal;
+	if (-into > craterSpeed) {
+		float radius = -into * craterSize;
+		craterTerrain(sweptHit.point - sweptHit.normal * landerRadius, radius, radius / 3);
+	}
+}
+
+// Indexes the triangles of every mesh of the lander model, in model space,
+// for checkCollisions().  The model matrix places them each frame, so the
+// tree is only rebuilt when a new model is loaded.
+//
+void ofApp::buildLanderTree() {
+	ofMesh merged;
+	for (unsigned int i = 0; i < rover.getNumMeshes(); i++) {
+		ofMesh mesh = rover.getMesh(i);
+		int base = merged.getNumVertices();
+		merged.addVertices(mesh.getVertices());
+		if (mesh.hasIndices()) {
+			for (ofIndexType index : mesh.getIndices()) merged.addIndex(base + index);
+		}
+		else {
+			for (int v = 0; v < (int)mesh.getNumVertices(); v++) merged.addIndex(base + v);
+		}
+	}
+	landerTree.primitives = TrianglePrimitives;
+	OctreeBuildParams params;
+	params.maxLevels = 8;
+	params.maxLeafSize = 8;
+	OctreeBuildStats stats = landerTree.create(merged, params);
+	printf("Lander tree: %d triangles, %d nodes, %.1fms\n", (int)merged.getNumIndices() / 3, stats.numNodes, stats.buildMs);
+}
+
+// Digs a bowl of "radius" and "depth" into the terrain around "center" and
+// updates the octree in place.  Only the vertices of the leaves around the
+// crater are looked at, and the heightfield hands the area over to the
+// octree.  A lidar scan still running is finished first, so nothing reads
+// the index while it changes.
+//
+void ofApp::craterTerrain(const ofVec3f & center, float radius, float depth) {
+	if (terrainIndex != &octree || !octree.bLinear) return;
+	Box region(Vector3(center.x - radius, center.y - radius, center.z - radius),
+		Vector3(center.x + radius, center.y + radius, center.z + radius));
+	vector<int> leaves;
+	if (!octree.intersect(region, 0, leaves)) return;
+
+	//triangle trees store triangle ids, so visit each triangle's corners
+	const ofMesh & mesh = octree.mesh;
+	int corners = (octree.primitives == TrianglePrimitives) ? 3 : 1;
+	vector<int> ids;
+	for (int leaf : leaves) {
+		NodeRef node = octree.ref(leaf);
+		for (int i = 0; i < node.size() * corners; i++) {
+			int p = node.point(i / corners);
+			ids.push_back(corners == 3 ? mesh.getIndex(3 * p + i % 3) : p);
+		}
+	}
+	std::sort(ids.begin(), ids.end());
+	ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+
+	vector<int> moved;
+	vector<glm::vec3> positions;
+	for (int id : ids) {
+		glm::vec3 v = mesh.getVertex(id);
+		float d2 = ((v.x - center.x) * (v.x - center.x) + (v.z - center.z) * (v.z - center.z)) / (radius * radius);
+		if (d2 >= 1) continue;
+		v.y -= depth * (1 - d2);
+		moved.push_back(id);
+		positions.push_back(v);
+	}
+	if (moved.empty()) return;
+
+	lidar.end();
+	OctreeUpdateStats stats = octree.update(moved, positions);
+	heightField.invalidate(center.x - radius, center.z - radius, center.x + radius, center.z + radius);
+	numCraters++;
+	printf("Crater %.2f wide: %d vertices moved, %d nodes refit, %d subtrees (%d primitives) rebuilt in %.2fms\n",
+		2 * radius, stats.moved, stats.refit, stats.rebuilt, stats.rebucketed, stats.updateMs);
+}
+
+// Predicted impact for the HUD and guidance: the arc the lander follows if
+// gravity and the current thrust stay as they are, with the integrator's
+// damping as drag, marched against the terrain index
+//
+void ofApp::predictImpact() {
+	float framerate = ofGetFrameRate();
+	if (bGrounded || framerate < 1) {
+		bImpact = false;
+		return;
+	}
+	Trajectory path;
+	path.position = vehicle->position;
+	path.velocity = vehicle->velocity;
+	path.acceleration = gForce->acceleration() + thrustForce->acceleration();
+	path.drag = -log(vehicle->damping) * framerate;
+
+	uint64_t start = ofGetElapsedTimeMicros();
+	bImpact = terrainIndex->sweep(path, landerRadius, impactHorizon, impactTolerance, impact);
+	impactUs = ofGetElapsedTimeMicros() - start;
+}
+
 //--------------------------------------------------------------
 void ofApp::draw(){
 	ofSetBackgroundColor(ofColor::black);
@@ -365,7 +595,7 @@ void ofApp::draw(){
 	if (bWireframe) {                    // wireframe mode  (include axis)
 		ofDisableLighting();
 		ofSetColor(ofColor::slateGray);
-		mars.drawWireframe();
+		drawTerrain(true);
 		if (bRoverLoaded) {
 			rover.drawWireframe();
 			if (!bTerrainSelected) drawAxis(rover.getPosition());
@@ -374,7 +604,7 @@ void ofApp::draw(){
 	}
 	else {
 		ofEnableLighting();              // shaded mode
-		mars.drawFaces();
+		drawTerrain(false);
 
 		if (bRoverLoaded) {
 			rover.drawFaces();
@@ -395,13 +625,27 @@ void ofApp::draw(){
 		ofDrawSphere(selectedPoint, .1);
 	}
 
+	if (bLidar) lidar.draw();
+
+	//Draws where the lander mesh crosses the terrain
+	if (!landerContacts.empty()) {
+		ofSetColor(ofColor::magenta);
+		for (const MeshContact & c : landerContacts) ofDrawSphere(c.point, .01);
+	}
+
+	//Draws the predicted impact point
+	if (bStart && !bOver && bImpact) {
+		ofSetColor(ofColor::red);
+		ofDrawSphere(impact.point, .05);
+	}
+
 	ofNoFill();
 
 	//Draws octree and leaves
-	if (bDrawTree) octree.draw(levels, 0);
+	if (bDrawTree) terrainIndex->draw(levels, 0);
 	else if (bDrawLeafs) {
 		ofSetColor(ofColor::white);
-		octree.drawLeafNodes();
+		terrainIndex->drawLeafNodes();
 	}
 
 
@@ -495,6 +739,41 @@ void ofApp::drawText() {
 	ofDrawBitmapString(altText, 10, 15);
 	ofDrawBitmapString(fpsText, ofGetWindowWidth() - 130, 15);
 	ofDrawBitmapString(timerText, 10, 40);
+
+	char impactText[128];
+	if (bImpact) {
+		snprintf(impactText, sizeof(impactText), "Impact: %.1fs, speed %.1f, slope %.0f deg (%.0fus, %d sweeps)",
+			impact.time, impact.velocity.length(), impact.slope, impactUs, impact.sweeps);
+	}
+	else snprintf(impactText, sizeof(impactText), "Impact: none within %.0fs (%.0fus)", impactHorizon, impactUs);
+	ofDrawBitmapString(impactText, 10, 65);
+
+	if (bLidar) {
+		char lidarText[128];
+		snprintf(lidarText, sizeof(lidarText), "Lidar: %d x %d, %d returns, scan %.1fms, wait %.1fms",
+			lidar.rows, lidar.cols, (int)lidar.points.size(), lidar.scanMs, lidar.waitMs);
+		ofDrawBitmapString(lidarText, 10, 90);
+	}
+
+	if (terrainIndex == &octree) {
+		char contactText[128];
+		float depth = 0;
+		for (const MeshContact & c : landerContacts) depth = std::max(depth, c.depth);
+		snprintf(contactText, sizeof(contactText), "Lander contact: %d points, %.3f deep (%.0fus)", (int)landerContacts.size(), depth, landerContactUs);
+		ofDrawBitmapString(contactText, 10, 115);
+	}
+
+	if (bTerrainChunks && terrainChunks.ready()) {
+		char chunkText[160];
+		snprintf(chunkText, sizeof(chunkText), "Terrain: %d of %d chunks, %d triangles in %d draws (cull %.0fus)",
+			terrainChunks.visibleChunks, terrainChunks.numChunks, terrainChunks.visibleTriangles, terrainChunks.drawCalls, terrainChunks.cullUs);
+		ofDrawBitmapString(chunkText, 10, 140);
+		const int * levels = terrainChunks.lodNodes;
+		if (terrainChunks.bLod) snprintf(chunkText, sizeof(chunkText), "LOD: %d / %d / %d / %d nodes at levels 0-3, %.1f pixel error",
+			levels[0], levels[1], levels[2], levels[3], terrainChunks.pixelError);
+		else snprintf(chunkText, sizeof(chunkText), "LOD: off");
+		ofDrawBitmapString(chunkText, 10, 165);
+	}
 }
 
 //Draws landing zones
@@ -598,6 +877,13 @@ void ofApp::keyPressed(int key) {
 	case 'o':
 		bDrawTree = !bDrawTree;
 		break;
+	case 'b':
+		benchmarkOctree();
+		benchmarkSpatialIndex();
+		break;
+	case 'k':
+		bTerrainChunks = !bTerrainChunks;
+		break;
 	case 'l':
 		bDrawLeafs = !bDrawLeafs;
 	case 's':
@@ -605,6 +891,21 @@ void ofApp::keyPressed(int key) {
 		break;
 	case 'u':
 		break;
+	case 'L':
+		bLidar = !bLidar;
+		// 64 x 1024 beams from 80 to 5 degrees below the horizon, set up
+		// the first time the sensor is switched on
+		//
+		if (bLidar && !lidar.ready()) lidar.setup(64, 1024, -80, -5, 30);
+		break;
+	case 'K':
+		if (lodFrames > 0) printf("LOD %s: mean frame %.2f ms, %.0f terrain triangles over %d frames\n", terrainChunks.bLod ? "on" : "off",
+			1000 * lodFrameSeconds / lodFrames, lodTriangles / lodFrames, lodFrames);
+		terrainChunks.bLod = !terrainChunks.bLod;
+		lodFrames = 0;
+		lodFrameSeconds = 0;
+		lodTriangles = 0;
+		break;
 	case 'v':
 		togglePointsDisplay();
 		break;
@@ -726,23 +1027,19 @@ void ofApp::mousePressed(int x, int y, int button){
 	rayDir.normalize();
 	Ray ray = Ray(Vector3(rayPoint.x, rayPoint.y, rayPoint.z),
 		Vector3(rayDir.x, rayDir.y, rayDir.z));
-	vector<TreeNode> intersected;
+	OctreeHit hit;
 
 	float time = ofGetElapsedTimef();
 
-	if (octree.intersect(ray, octree.root, intersected)) {
+	//With the vertices shown, the vertex nearest the mouse
+	if (bDisplayPoints) {
+		bool bFound = doPointSelection();
+		printf("%s in %0.5fms\n", bFound ? "Selected vertex" : "No vertex selected", (ofGetElapsedTimef() - time) * 1000);
+	}
+	//Exact point on the terrain under the mouse
+	else if (terrainIndex->intersect(ray, hit)) {
 		bPointSelected = true;
-		float closest = INT_MAX;
-		int closestIndex = 0;
-		for (int i = 0; i < intersected.size(); i++) {
-			glm::vec3 vertex = octree.mesh.getVertex(intersected[i].points[0]);
-			float distance = glm::length(vertex - currentCam->getPosition());
-			if (closest > distance) {
-				closest = distance;
-				closestIndex = i;
-			}
-		}
-		selectedPoint = octree.mesh.getVertex(intersected[closestIndex].points[0]);
+		selectedPoint = hit.point;
 		printf("Found intersect in %0.5fms\n", (ofGetElapsedTimef() - time) * 1000);
 		//cout << selectedPoint << endl << endl;							// for basic testing optimization
 	}
@@ -752,97 +1049,31 @@ void ofApp::mousePressed(int x, int y, int button){
 	}
 }
 
-bool ofApp::octreePointSelection() {
-	ofMesh mesh = mars.getMesh(0);
-
-	float nearestDistance = 0;
-	bPointSelected = false;
-
-	ofVec2f mouse(mouseX, mouseY);
-	vector<ofVec3f> selection;
-
-	for (int i = 0; i < selectedNode.points.size(); i++) {
-		ofVec3f vert = mesh.getVertex(selectedNode.points.at(i));
-		ofVec3f posScreen = currentCam->worldToScreen(vert);
-		float distance = posScreen.distance(mouse);
-		if (distance < selectionRange) {
-			selection.push_back(vert);
-			bPointSelected = true;
-		}
-	}
-
-	if (bPointSelected) {
-		float distance = 0;
-		for (int i = 0; i < selection.size(); i++) {
-			ofVec3f point = currentCam->worldToCamera(selection[i]);
-
-			// In camera space, the camera is at (0,0,0), so distance from 
-			// the camera is simply the length of the point vector
-			//
-			float curDist = point.length();
-
-			if (i == 0 || curDist < distance) {
-				distance = curDist;
-				selectedPoint = selection[i];
-			}
-		}
-	}
-
-	return bPointSelected;
-}
-
 //
 //  ScreenSpace Selection Method: 
-//  This is not the octree method, but will give you an idea of comparison
-//  of speed between octree and screenspace.
-//
 //  Select Target Point on Terrain by comparing distance of mouse to 
-//  vertice points projected onto screenspace.
+//  vertice points projected onto screenspace.  The terrain index hands
+//  over the vertices in a cone around the mouse ray, nearest the camera
+//  first, so only the leaves around the pick are looked at; the first one
+//  within selectionRange on screen is the target (the cone is a little
+//  wider than the pick away from the center of the view).
 //  if a point is selected, return true, else return false;
 //
 bool ofApp::doPointSelection() {
-
-	ofMesh mesh = mars.getMesh(0);
-	int n = mesh.getNumVertices();
-	float nearestDistance = 0;
-	int nearestIndex = 0;
-
-	bPointSelected = false;
-
 	ofVec2f mouse(mouseX, mouseY);
-	vector<ofVec3f> selection;
+	ofVec3f eye = currentCam->getPosition();
+	ofVec3f axis = ofVec3f(currentCam->screenToWorld(glm::vec3(mouseX, mouseY, 0))) - eye;
+	float slope = selectionRange * 2 * tan(ofDegToRad(currentCam->getFov()) / 2) / ofGetHeight();
+	vector<PickPoint> candidates;
+	terrainIndex->intersect(PickCone(eye, axis, slope), candidates);
 
-	// We check through the mesh vertices to see which ones
-	// are "close" to the mouse point in screen space.  If we find 
-	// points that are close, we store them in a vector (dynamic array)
-	//
-	for (int i = 0; i < n; i++) {
-		ofVec3f vert = mesh.getVertex(i);
-		ofVec3f posScreen = currentCam->worldToScreen(vert);
-		float distance = posScreen.distance(mouse);
-		if (distance < selectionRange) {
-			selection.push_back(vert);
+	bPointSelected = false;
+	for (const PickPoint & pick : candidates) {
+		ofVec3f posScreen = currentCam->worldToScreen(pick.point);
+		if (ofVec2f(posScreen.x, posScreen.y).distance(mouse) < selectionRange) {
+			selectedPoint = pick.point;
 			bPointSelected = true;
-		}
-	}
-
-	//  if we found selected points, we need to determine which
-	//  one is closest to the eye (camera). That one is our selected target.
-	//
-	if (bPointSelected) {
-		float distance = 0;
-		for (int i = 0; i < selection.size(); i++) {
-			ofVec3f point = currentCam->worldToCamera(selection[i]);
-
-			// In camera space, the camera is at (0,0,0), so distance from 
-			// the camera is simply the length of the point vector
-			//
-			float curDist = point.length();
-
-			if (i == 0 || curDist < distance) {
-				distance = curDist;
-				selectedPoint = selection[i];
-			}
+			break;
 		}
 	}
 	return bPointSelected;
@@ -1052,6 +1283,7 @@ void ofApp::dragEvent(ofDragInfo dragInfo) {
 		rover.setScale(.005, .005, .005);
 		rover.setPosition(point.x, point.y, point.z);
 		bRoverLoaded = true;
+		buildLanderTree();
 	}
 	else cout << "Error: Can't load model" << dragInfo.files[0] << endl;
 }
@@ -1081,4 +1313,330 @@ void ofApp::loadVbo() {
 	vbo.clear();
 	vbo.setVertexData(&points[0], total, GL_STATIC_DRAW);
 	vbo.setNormalData(&sizes[0], total, GL_STATIC_DRAW);
-}
\ No newline at end of file
+}
+
+//  Octree benchmark: builds the terrain octree with each layout and prints
+//  node count, memory and average latency of the per-frame point (collision)
+//  and down ray (altitude) queries at the same random sample positions.
+//
+void ofApp::benchmarkOctree() {
+	const int numQueries = 10000;
+	const ofMesh & mesh = terrainIndex == &bvh ? bvh.mesh : octree.mesh;
+	Box bounds = Octree::meshBounds(mesh);
+	Vector3 bmin = bounds.min();
+	Vector3 bmax = bounds.max();
+
+	vector<ofVec3f> samples;
+	for (int i = 0; i < numQueries; i++) {
+		samples.push_back(ofVec3f(ofRandom(bmin.x(), bmax.x()), ofRandom(bmin.y(), bmax.y()), ofRandom(bmin.z(), bmax.z())));
+	}
+
+	printf("Octree benchmark: levels = %d, %d queries, %s child box test\n", levels, numQueries, Box8::kernel());
+	for (int layout = 0; layout < 2; layout++) {
+		Octree tree;
+		tree.bLinear = (layout == 1);
+		tree.numThreads = 0;
+
+		uint64_t start = ofGetElapsedTimeMicros();
+		tree.create(mesh, levels);
+		float buildMs = (ofGetElapsedTimeMicros() - start) / 1000.0;
+
+		int hits = 0;
+		start = ofGetElapsedTimeMicros();
+		for (int i = 0; i < numQueries; i++) {
+			if (tree.bLinear) {
+				int node;
+				if (tree.intersect(samples[i], 0, node)) hits++;
+			}
+			else {
+				const TreeNode * node;
+				if (tree.intersect(samples[i], tree.root, node)) hits++;
+			}
+		}
+		float pointUs = (ofGetElapsedTimeMicros() - start) / (float)numQueries;
+
+		start = ofGetElapsedTimeMicros();
+		for (int i = 0; i < numQueries; i++) {
+			Ray ray = Ray(Vector3(samples[i].x, bmax.y(), samples[i].z), Vector3(0, -1, 0));
+			if (tree.bLinear) {
+				int node;
+				if (tree.intersect(ray, 0, node)) hits++;
+			}
+			else {
+				const TreeNode * node;
+				if (tree.intersect(ray, tree.root, node)) hits++;
+			}
+		}
+		float rayUs = (ofGetElapsedTimeMicros() - start) / (float)numQueries;
+
+		printf("  %-8s build %8.1fms  nodes %8d  memory %8.2fMB  point %7.2fus  ray %7.2fus  (%d hits)\n",
+			tree.bLinear ? "flat" : "pointer", buildMs, tree.numNodes(), tree.memoryUsage() / (1024.0 * 1024.0),
+			pointUs, rayUs, hits);
+	}
+
+	// exact down ray hits on triangle leaves: accuracy no longer depends on depth
+	//
+	printf("Exact ray hits (triangle leaves):\n");
+	for (int hitLevels = 4; hitLevels <= levels; hitLevels++) {
+		Octree tree;
+		tree.numThreads = 0;
+		tree.primitives = TrianglePrimitives;
+		uint64_t start = ofGetElapsedTimeMicros();
+		tree.create(mesh, hitLevels);
+		float buildMs = (ofGetElapsedTimeMicros() - start) / 1000.0;
+
+		int hits = 0;
+		start = ofGetElapsedTimeMicros();
+		for (int i = 0; i < numQueries; i++) {
+			Ray ray = Ray(Vector3(samples[i].x, bmax.y(), samples[i].z), Vector3(0, -1, 0));
+			OctreeHit hit;
+			if (tree.intersect(ray, hit)) hits++;
+		}
+		float rayUs = (ofGetElapsedTimeMicros() - start) / (float)numQueries;
+		printf("  levels %2d  build %8.1fms  nodes %8d  memory %8.2fMB  ray %7.2fus  (%d hits)\n",
+			hitLevels, buildMs, tree.numNodes(), tree.memoryUsage() / (1024.0 * 1024.0), rayUs, hits);
+	}
+
+	// flat layout builders: recursive partitioning vs bottom-up Morton codes
+	//
+	printf("Octree builders (flat layout):\n");
+	for (int buildLevels = 6; buildLevels <= 12; buildLevels++) {
+		for (int type = PartitionBuild; type <= MortonBuild; type++) {
+			Octree tree;
+			tree.numThreads = 0;
+			uint64_t start = ofGetElapsedTimeMicros();
+			tree.create(mesh, buildLevels, (OctreeBuildType)type);
+			float buildMs = (ofGetElapsedTimeMicros() - start) / 1000.0;
+			printf("  levels %2d  %-9s build %8.1fms  nodes %8d  memory %8.2fMB\n", buildLevels,
+				type == MortonBuild ? "morton" : "partition", buildMs, tree.numNodes(), tree.memoryUsage() / (1024.0 * 1024.0));
+		}
+	}
+
+	// subdivision policies at a deep level limit: leaf size, cell size and
+	// memory budget trade memory against down ray latency
+	//
+	printf("Subdivision policies (triangle leaves, 12 levels):\n");
+	Vector3 extent = bmax - bmin;
+	float longest = std::max(extent.x(), std::max(extent.y(), extent.z()));
+	OctreeBuildParams policies[7];
+	for (int i = 0; i < 7; i++) policies[i].maxLevels = 12;
+	policies[1].maxLeafSize = 4;
+	policies[2].maxLeafSize = 16;
+	policies[3].maxLeafSize = 4;
+	policies[3].minCellSize = longest / 256;
+	policies[4].maxLeafSize = 4;
+	policies[4].memoryBudget = 8 << 20;
+	policies[5].maxLeafSize = 4;
+	policies[5].memoryBudget = 4 << 20;
+	policies[6].maxLeafSize = 4;
+	policies[6].memoryBudget = 2 << 20;
+	for (int i = 0; i < 7; i++) {
+		Octree tree;
+		tree.numThreads = 0;
+		tree.primitives = TrianglePrimitives;
+		OctreeBuildStats stats = tree.create(mesh, policies[i]);
+
+		int hits = 0;
+		uint64_t start = ofGetElapsedTimeMicros();
+		for (int j = 0; j < numQueries; j++) {
+			Ray ray = Ray(Vector3(samples[j].x, bmax.y(), samples[j].z), Vector3(0, -1, 0));
+			OctreeHit hit;
+			if (tree.intersect(ray, hit)) hits++;
+		}
+		float rayUs = (ofGetElapsedTimeMicros() - start) / (float)numQueries;
+		printf("  leaf %2d  cell %6.3f  budget %5.1fMB  levels %2d  build %8.1fms  nodes %8d  leaves %8d (mean %5.1f, max %5d)  depth %2d  cuts %5d  memory %6.2fMB  ray %7.2fus  (%d hits)\n",
+			policies[i].maxLeafSize, policies[i].minCellSize, policies[i].memoryBudget / (1024.0 * 1024.0), stats.numLevels, stats.buildMs,
+			stats.numNodes, stats.numLeaves, stats.meanLeafPoints, stats.maxLeafPoints, stats.depth, stats.budgetCuts, stats.memory / (1024.0 * 1024.0), rayUs, hits);
+	}
+
+	// compaction: chain collapsing and 16 bit leaves against the mesh itself
+	//
+	size_t meshBytes = mesh.getNumVertices() * sizeof(glm::vec3) + mesh.getNumIndices() * sizeof(ofIndexType);
+	printf("Compaction (levels = %d, mesh %.2fMB):\n", levels, meshBytes / (1024.0 * 1024.0));
+	for (int prim = VertexPrimitives; prim <= TrianglePrimitives; prim++) {
+		for (int mode = 0; mode < 3; mode++) {
+			OctreeBuildParams params;
+			params.maxLevels = levels;
+			params.collapseChains = mode > 0;
+			params.compactIndices = mode > 1;
+			Octree tree;
+			tree.numThreads = 0;
+			tree.primitives = (OctreePrimitiveType)prim;
+			OctreeBuildStats stats = tree.create(mesh, params);
+			printf("  %-9s %-17s nodes %8d  collapsed %7d  memory %6.2fMB  %5.1f bytes/node  %6.1f bytes/triangle\n",
+				prim == TrianglePrimitives ? "triangles" : "vertices", mode == 0 ? "full" : (stats.compact ? "collapsed, 16 bit" : "collapsed"),
+				stats.numNodes, stats.collapsed, stats.memory / (1024.0 * 1024.0), stats.bytesPerNode, stats.bytesPerTriangle);
+		}
+	}
+}
+
+//  Octree vs BVH on each shipped terrain that is present: build time, memory
+//  and throughput of the three queries the app runs through SpatialIndex,
+//  then the heightfield lookup that replaces the altitude ray.
+//
+void ofApp::benchmarkSpatialIndex() {
+	const int numQueries = 10000;
+	const char * terrains[] = { "geo/Lunar_Lander_mars_terrain_model.obj", "geo/mars-low-v2.obj" };
+
+	printf("Spatial index benchmark: octree levels = %d, %d queries, %s ray packets\n", levels, numQueries, RayPacket::kernel());
+	for (const char * terrain : terrains) {
+		ofxAssimpModelLoader model;
+		if (!model.loadModel(terrain)) {
+			printf("  %s: not found, skipped\n", terrain);
+			continue;
+		}
+		ofMesh mesh = model.getMesh(0);
+		Box bounds = Octree::meshBounds(mesh);
+		Vector3 bmin = bounds.min();
+		Vector3 bmax = bounds.max();
+		vector<ofVec3f> samples;
+		for (int i = 0; i < numQueries; i++) {
+			samples.push_back(ofVec3f(ofRandom(bmin.x(), bmax.x()), ofRandom(bmin.y(), bmax.y()), ofRandom(bmin.z(), bmax.z())));
+		}
+		printf("  %s: %d triangles\n", terrain, (int)mesh.getNumIndices() / 3);
+
+		// a 90 degree radar fan from above the middle of the terrain, in scan
+		// line order, and the same rays shuffled
+		//
+		const int fanSize = 256;
+		ofVec3f eye((bmin.x() + bmax.x()) / 2, 2 * bmax.y() - bmin.y(), (bmin.z() + bmax.z()) / 2);
+		vector<ofVec3f> fanDirections;
+		for (int row = 0; row < fanSize; row++) {
+			for (int col = 0; col < fanSize; col++) {
+				ofVec3f dir(2.0f * col / (fanSize - 1) - 1, -1, 2.0f * row / (fanSize - 1) - 1);
+				fanDirections.push_back(dir.getNormalized());
+			}
+		}
+		RayBatch fan;
+		for (const ofVec3f & dir : fanDirections) fan.add(eye, dir);
+		ofRandomize(fanDirections);
+		RayBatch shuffled;
+		for (const ofVec3f & dir : fanDirections) shuffled.add(eye, dir);
+
+		Octree tree;
+		tree.numThreads = 0;
+		tree.primitives = TrianglePrimitives;
+		BVH hierarchy;
+		for (int type = 0; type < 2; type++) {
+			SpatialIndex * index = type == 0 ? (SpatialIndex *)&tree : &hierarchy;
+			uint64_t start = ofGetElapsedTimeMicros();
+			if (type == 0) tree.create(mesh, levels);
+			else hierarchy.create(mesh);
+			float buildMs = (ofGetElapsedTimeMicros() - start) / 1000.0;
+
+			int hits = 0;
+			NodeRef contact;
+			start = ofGetElapsedTimeMicros();
+			for (int i = 0; i < numQueries; i++) {
+				if (index->intersect(samples[i], contact)) hits++;
+			}
+			float pointUs = (ofGetElapsedTimeMicros() - start) / (float)numQueries;
+
+			OctreeHit hit;
+			start = ofGetElapsedTimeMicros();
+			for (int i = 0; i < numQueries; i++) {
+				Ray ray = Ray(Vector3(samples[i].x, bmax.y(), samples[i].z), Vector3(0, -1, 0));
+				if (index->intersect(ray, hit)) hits++;
+			}
+			float rayUs = (ofGetElapsedTimeMicros() - start) / (float)numQueries;
+
+			// a body skimming the surface in small steps: from the root every
+			// time, then from a cursor
+			//
+			vector<ofVec3f> path;
+			ofVec3f pos(bmin.x(), (bmin.y() + bmax.y()) / 2, bmin.z());
+			ofVec3f step = ofVec3f(bmax.x() - bmin.x(), 0, bmax.z() - bmin.z()) / numQueries;
+			for (int i = 0; i < numQueries; i++) {
+				pos += step;
+				Ray ray = Ray(Vector3(pos.x, bmax.y(), pos.z), Vector3(0, -1, 0));
+				if (index->intersect(ray, hit)) pos.y = hit.point.y;
+				path.push_back(pos);
+			}
+			start = ofGetElapsedTimeMicros();
+			for (int i = 0; i < numQueries; i++) {
+				if (index->intersect(path[i], contact)) hits++;
+			}
+			float pathUs = (ofGetElapsedTimeMicros() - start) / (float)numQueries;
+			QueryCursor cursor;
+			int boxTests = 0;
+			start = ofGetElapsedTimeMicros();
+			for (int i = 0; i < numQueries; i++) {
+				if (index->intersect(path[i], cursor, contact)) hits++;
+				boxTests += cursor.boxTests;
+			}
+			float cursorUs = (ofGetElapsedTimeMicros() - start) / (float)numQueries;
+
+			// swept lander steps: a sphere dropping a tenth of the terrain height
+			//
+			float drop = (bmax.y() - bmin.y()) / 10;
+			float sweepRadius = (bmax.x() - bmin.x()) / 1000;
+			start = ofGetElapsedTimeMicros();
+			for (int i = 0; i < numQueries; i++) {
+				if (index->sweep(samples[i], samples[i] - ofVec3f(0, drop, 0), sweepRadius, hit)) hits++;
+			}
+			float sweepUs = (ofGetElapsedTimeMicros() - start) / (float)numQueries;
+
+			vector<NodeRef> refs;
+			start = ofGetElapsedTimeMicros();
+			for (int i = 0; i < numQueries; i++) {
+				Ray ray = Ray(Vector3(samples[i].x, bmax.y(), samples[i].z), Vector3(0, -1, 0));
+				if (index->intersect(ray, refs)) hits++;
+			}
+			float collectUs = (ofGetElapsedTimeMicros() - start) / (float)numQueries;
+
+			printf("    %-6s build %8.1fms  nodes %8d  memory %8.2fMB  point %7.2fus  ray %7.2fus (%.2f Mrays/s)  collect %7.2fus  (%d hits)\n",
+				type == 0 ? "octree" : "bvh", buildMs, index->numNodes(), index->memoryUsage() / (1024.0 * 1024.0),
+				pointUs, rayUs, 1 / rayUs, collectUs, hits);
+			printf("           surface path: root %7.3fus  cursor %7.3fus  (%.1f boxes per query)  sphere sweep %7.2fus\n",
+				pathUs, cursorUs, boxTests / (float)numQueries, sweepUs);
+
+			// the fan one ray at a time, as a batch, and shuffled as a batch
+			//
+			vector<OctreeHit> fanHits;
+			float fanRate[3];
+			int fanCount = 0;
+			for (int mode = 0; mode < 3; mode++) {
+				start = ofGetElapsedTimeMicros();
+				if (mode == 0) {
+					for (int i = 0; i < fan.size(); i++) {
+						if (index->intersect(fan.ray(i), hit)) fanCount++;
+					}
+				}
+				else index->intersect(mode == 1 ? fan : shuffled, fanHits);
+				fanRate[mode] = fan.size() / (float)(ofGetElapsedTimeMicros() - start);
+			}
+			printf("           %dx%d fan: one at a time %6.2f Mrays/s  batch %6.2f Mrays/s  shuffled batch %6.2f Mrays/s  (%d hits)\n",
+				fanSize, fanSize, fanRate[0], fanRate[1], fanRate[2], fanCount);
+
+			// full lidar scans from the top of the fan, on one pool worker and
+			// on every hardware thread
+			//
+			for (int threads = 1; threads >= 0; threads--) {
+				LidarSensor sensor;
+				sensor.numThreads = threads;
+				sensor.setup(64, 1024, -80, -5, (bmax - bmin).length());
+				sensor.begin(*index, eye);
+				sensor.end();
+				printf("           lidar %dx%d: %2d workers  scan %7.1fms (%5.1f Hz)  %d returns\n", sensor.rows, sensor.cols,
+					threads > 0 ? threads : TaskPool::defaultThreads(), sensor.scanMs, 1000 / sensor.scanMs, (int)sensor.points.size());
+			}
+		}
+
+		// altitude through the heightfield instead of a down ray
+		//
+		HeightField field;
+		uint64_t start = ofGetElapsedTimeMicros();
+		field.create(mesh, heightFieldResolution);
+		float buildMs = (ofGetElapsedTimeMicros() - start) / 1000.0;
+		int hits = 0;
+		float height;
+		ofVec3f normal;
+		start = ofGetElapsedTimeMicros();
+		for (int i = 0; i < numQueries; i++) {
+			if (field.ground(samples[i].x, samples[i].z, height, normal)) hits++;
+		}
+		float groundUs = (ofGetElapsedTimeMicros() - start) / (float)numQueries;
+		printf("    %-6s build %8.1fms  samples %6d  memory %8.2fMB  ground %7.3fus  (%d hits, %d samples fall back)\n",
+			"height", buildMs, field.cols * field.rows, field.memoryUsage() / (1024.0 * 1024.0), groundUs, hits, field.numFlagged());
+	}
+}
@@ -6,6 +6,10 @@
 #include "box.h"
 #include "ray.h"
 #include "Octree.h"
+#include "TerrainChunks.h"
+#include "BVH.h"
+#include "HeightField.h"
+#include "LidarSensor.h"
 #include "ParticleSystem.h"
 #include "ParticleEmitter.h"
 
@@ -35,12 +39,18 @@ class ofApp : public ofBaseApp{
 		void toggleWireframeMode();
 		void toggleSelectTerrain();
 		bool doPointSelection();
-		bool octreePointSelection();
 		void drawText();
 		void vehicleMove();
 		void checkCollisions();
+		void sweepVehicle(const ofVec3f & lastPosition);
+		void predictImpact();
+		void craterTerrain(const ofVec3f & center, float radius, float depth);
+		void drawTerrain(bool bLines);
+		void buildLanderTree();
 		void loadVbo();
 		void drawLandingZone();
+		void benchmarkOctree();
+		void benchmarkSpatialIndex();
 
 		bool mouseIntersectPlane(ofVec3f planePoint, ofVec3f planeNorm, ofVec3f &point);
 
@@ -56,11 +66,43 @@ class ofApp : public ofBaseApp{
 		ofxAssimpModelLoader mars, rover;
 		Box boundingBox;
 
-		TreeNode selectedNode;
-
 		ofVec3f selectedPoint;
 
 		Octree octree;
+		BVH bvh;
+		SpatialIndex *terrainIndex;	// octree or bvh, whichever setup() built
+		bool bUseBVH = false;		// pick the terrain index at startup
+		HeightField heightField;	// altitude and ground contact; the index is only asked where it overhangs
+		int heightFieldResolution = 512;
+		OctreeHit groundHit;		// terrain straight below the lander, updated every frame
+		bool bGroundHit = false;
+		bool bGroundFromHeightField = false;
+		QueryCursor landerCursor;	// last terrain leaf the lander was found in
+		OctreeHit sweptHit;			// first contact during the last integration step
+		bool bSweptContact = false;
+		float landerRadius = 0;		// 0 sweeps the lander as a point, > 0 as a sphere
+		TrajectoryHit impact;		// where the lander's current arc meets the terrain, updated every frame
+		bool bImpact = false;
+		float impactUs = 0;
+		float impactHorizon = 30;	// seconds of flight looked ahead
+		float impactTolerance = .01;	// how far the marched chords may stray from the arc
+		LidarSensor lidar;			// scans the terrain from the lander while bLidar is set
+		bool bLidar = false;
+		float craterSpeed = 2;		// impacts faster than this (into the surface) dent the terrain; octree only
+		float craterSize = .15;		// crater radius per unit of impact speed, a third of it deep
+		int numCraters = 0;
+		Octree landerTree;			// lander model triangles in model space, tested against the terrain octree
+		vector<MeshContact> landerContacts;	// where the lander mesh crosses the terrain, updated every frame
+		float landerContactUs = 0;
+		TerrainChunks terrainChunks;	// octree aligned pieces of the terrain, culled to the camera; octree only
+		bool bTerrainChunks = true;
+		int terrainChunkLevel = 5;
+		int terrainLodLevel = 3;		// octree level of the nodes that get simplified versions
+		int lodFrames = 0;			// frames, frame time and terrain triangles since LOD was last toggled
+		float lodFrameSeconds = 0;
+		double lodTriangles = 0;
+		ofTexture terrainTexture;
+		ofMaterial terrainMaterial;
 
 		Particle *vehicle;
 		ParticleSystem *vehicleSys;
@@ -77,6 +119,7 @@ class ofApp : public ofBaseApp{
 		float altitude;
 
 		int levels;
+		OctreeBuildParams octreeParams;		// subdivision policy of the terrain octree; maxLevels comes from levels
 
 		bool bDrawTree;
 		bool bDrawLeafs;